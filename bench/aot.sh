@@ -0,0 +1,30 @@
+#!/usr/bin/env bash
+# Time the interpreter against igorc output on the same scripts, a whole process per run
+# usage: bench/aot.sh [runs] [script.ig ...]
+
+set -e
+cd "$(dirname "$0")/.."
+
+runs=${1:-200}
+shift || true
+scripts=${@:-bench/*.ig}
+
+TIMEFORMAT=%R
+printf "%-24s %14s %14s\n" "script (ms/run)" "igor" "igorc"
+
+for script in $scripts; do
+  name=$(basename "$script" .ig)
+  bin/igorc "$script" -o "bin/$name"
+
+  if ! cmp -s <(bin/igor "$script") <(bin/$name); then
+    echo "$script: compiled output differs from the interpreter" >&2
+    exit 1
+  fi
+
+  t_igor=$( { time for ((i = 0; i < runs; i++)); do bin/igor "$script" > /dev/null; done; } 2>&1 )
+  t_igorc=$( { time for ((i = 0; i < runs; i++)); do "bin/$name" > /dev/null; done; } 2>&1 )
+
+  awk -v s="$script" -v a="$t_igor" -v b="$t_igorc" -v n="$runs" \
+    'BEGIN { printf "%-24s %14.3f %14.3f\n", s, a * 1000 / n, b * 1000 / n }'
+  rm -f "bin/$name"
+done
@@ -0,0 +1,591 @@
+/* Wall clock time and the number of processors are outside of plain C99 */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "../lib/mpc.h"
+#include "parse.h"
+#include "opt.h"
+#include "jit.h"
+#include "vm.h"
+#include "seq.h"
+#include "par.h"
+#include "react.h"
+
+/* The original tree-walking evaluator, kept here as a baseline */
+
+ival* walk(ienv* e, ival* v);
+
+ival* walk_sexpr(ienv* e, ival* v) {
+
+  for (int i = 0; i < v->count; i++) { v->cell[i] = walk(e, v->cell[i]); }
+  for (int i = 0; i < v->count; i++) { if (v->cell[i]->type == IVAL_ERR) { return ival_take(v, i); } }
+
+  if (v->count == 0) { return v; }
+  if (v->count == 1) { return ival_take(v, 0); }
+
+  ival* f = ival_pop(v, 0);
+  if (f->type != IVAL_FUN) {
+    ival* err = ival_err(
+      "S-Expression starts with incorrect type. Got %s, Expected %s.",
+      ltype_name(f->type), ltype_name(IVAL_FUN));
+    ival_del(f); ival_del(v);
+    return err;
+  }
+
+  ival* result = f->fun(e, v);
+  ival_del(f);
+  return result;
+}
+
+ival* walk(ienv* e, ival* v) {
+  if (v->type == IVAL_SYM) {
+    ival* x = ienv_get(e, v);
+    ival_del(v);
+    return x;
+  }
+  if (v->type == IVAL_SEXPR) { return walk_sexpr(e, v); }
+  return v;
+}
+
+double elapsed_ns(clock_t start, int iterations) {
+  return (double)(clock() - start) / CLOCKS_PER_SEC * 1e9 / iterations;
+}
+
+/* The original strcmp-dispatched arithmetic, kept as a baseline for the kernels */
+
+ival* builtin_op(ienv* e, ival* a, char* op) {
+
+  for (int i = 0; i < a->count; i++) {
+    if (a->cell[i]->type != IVAL_NUM) {
+      ival_del(a);
+      return ival_err("Function '%s' passed incorrect type for argument %i.", op, i);
+    }
+  }
+
+  ival* x = ival_pop(a, 0);
+
+  if ((strcmp(op, "-") == 0) && a->count == 0) { x->num = -x->num; }
+
+  while (a->count > 0) {
+    ival* y = ival_pop(a, 0);
+
+    if (strcmp(op, "+") == 0) { x->num += y->num; }
+    if (strcmp(op, "-") == 0) { x->num -= y->num; }
+    if (strcmp(op, "*") == 0) { x->num *= y->num; }
+    if (strcmp(op, "/") == 0) {
+      if (y->num == 0) {
+        ival_del(x); ival_del(y); ival_del(a);
+        return ival_err("Division By Zero.");
+      }
+      x->num /= y->num;
+    }
+
+    ival_del(y);
+  }
+
+  ival_del(a);
+  return x;
+}
+
+ival* numbers(int n) {
+  ival* a = ival_sexpr();
+  for (int i = 0; i < n; i++) { ival_add(a, ival_num(i + 1)); }
+  return a;
+}
+
+/* Operands made ahead of each timed batch of calls, as the builtins consume them, few enough to stay in cache */
+#define BENCH_BATCH 4096
+
+static double now_ns(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+/* Time one operator on "n" operands through builtin_op, or the kernel if given one, with only the calls timed */
+static double bench_apply(ienv* e, char* op, ibuiltin kernel, int n, int iterations) {
+  ival* batch[BENCH_BATCH];
+  int size = BENCH_BATCH / n > 0 ? BENCH_BATCH / n : 1;
+  double total = 0;
+  for (int done = 0; done < iterations;) {
+    int k = iterations - done < size ? iterations - done : size;
+    for (int i = 0; i < k; i++) { batch[i] = numbers(n); }
+
+    double start = now_ns();
+    if (kernel) {
+      for (int i = 0; i < k; i++) { ival_del(kernel(e, batch[i])); }
+    } else {
+      for (int i = 0; i < k; i++) { ival_del(builtin_op(e, batch[i], op)); }
+    }
+    total += now_ns() - start;
+    done += k;
+  }
+  return total / iterations;
+}
+
+void bench_operands(ienv* e, char* op, ibuiltin kernel, int n, int iterations) {
+  double t_before = bench_apply(e, op, NULL, n, iterations);
+  double t_after = bench_apply(e, op, kernel, n, iterations);
+  printf("%-4s %8i operands %12.2f %12.2f\n", op, n, t_before / n, t_after / n);
+}
+
+/* An error's message formatted as soon as it is raised, as ival_err once did */
+static char* bench_format(char* fmt, ...) {
+  va_list va;
+  va_start(va, fmt);
+  char* s = malloc(512);
+  vsnprintf(s, 511, fmt, va);
+  s = realloc(s, strlen(s)+1);
+  va_end(va);
+  return s;
+}
+
+/* Raise and drop one error, formatting it up front and leaving it to be printed */
+#define BENCH_ERROR(name, ...) do { \
+  clock_t start = clock(); \
+  for (int i = 0; i < iterations; i++) { ival* v = ival_num(0); free(bench_format(__VA_ARGS__)); ival_del(v); } \
+  double t_formatted = elapsed_ns(start, iterations); \
+  start = clock(); \
+  for (int i = 0; i < iterations; i++) { ival_del(ival_err(__VA_ARGS__)); } \
+  printf("%-22s %12.1f %12.1f\n", name, t_formatted, elapsed_ns(start, iterations)); \
+} while (0)
+
+void bench_errors(int iterations) {
+  BENCH_ERROR("no arguments", "Division By Zero.");
+  BENCH_ERROR("symbol", "Unbound Symbol '%s'", "nosuchthing");
+  BENCH_ERROR("type", "Function '%s' passed incorrect type for argument %i. Got %s, Expected %s.",
+    "+", 1, ltype_name(IVAL_QEXPR), ltype_name(IVAL_NUM));
+}
+
+/* Sum 1..n from a list of numbers made for it, against reducing over a range */
+void bench_range(ienv* e, int n, int iterations) {
+  clock_t start = clock();
+  for (int i = 0; i < iterations; i++) { ival_del(builtin_add(e, numbers(n))); }
+  double t_list = elapsed_ns(start, iterations);
+
+  start = clock();
+  for (int i = 0; i < iterations; i++) {
+    ival* a = ival_add(ival_sexpr(), ival_seq(iseq_range(1, n + 1, 1)));
+    ival_del(builtin_add(e, a));
+  }
+  double t_range = elapsed_ns(start, iterations);
+
+  printf("%-4s %8i elements %12.2f %12.2f\n", "+", n, t_list / n, t_range / n);
+}
+
+/* Benchmarks */
+
+static char* programs[] = {
+  "+ 1 2 3 4 5",
+  "(* 60 60 24)",
+  "+ (* 2 3) (- 10 4) (/ 100 5) (* (+ 1 2) (+ 3 4))",
+  "+ a (* a b) (- b a)",
+  "/ (- (* a a) (* b b) (- a)) (+ a 1)",
+  "head (join {1 2 3} {4 5 6} (list 7 8 9))",
+};
+
+/* Nested arithmetic, as generated code is full of */
+static char* sums[] = {
+  "+ (* a b) a",
+  "- (* a a) (* b b)",
+  "+ a (* a b) (- b a)",
+  "/ (- (* a a) (* b b) (- a)) (+ a 1)",
+};
+
+/* Calls with arguments made by other builtins, whose types are known before they are run */
+static char* proofs[] = {
+  "+ (* a a) (- b 1) (* 2 a b)",
+  "/ (* (+ a b) (- b a)) (+ a 1) (- b 10)",
+  "join (list a b) {1 2 3} (list b a)",
+  "head (tail (join (list a b) (list b a)))",
+};
+
+/* Lambdas, each doing the same work as the builtin call beside it */
+static char* lambdas = "def {sq add first} (\\ {x} {* x x}) (\\ {x y} {+ x y}) (\\ {x & xs} {x})";
+
+/* A lambda building a list, and the same with its results cached */
+static char* memos = "def {rows mrows} (\\ {x y} {join (list x y x y) (list y x y x) (tail (list x y x y))}) "
+                     "(memo (\\ {x y} {join (list x y x y) (list y x y x) (tail (list x y x y))}))";
+
+static char* calls[][2] = {
+  { "* a a",           "sq a"        },
+  { "+ a b",           "add a b"     },
+  { "head {a b}",      "first a b"   },
+};
+
+/* A chain of maps and filters ending in a fold, over a list and a range */
+static char* pipes = "def {inc odd sq add} (\\ {x} {+ x 1}) (\\ {x} {- x (* 2 (/ x 2))}) (\\ {x} {* x x}) "
+                     "(\\ {a b} {+ a b})";
+
+static char* chains[] = {
+  "fold add 0 (map sq (filter odd (map inc xs)))",
+  "fold add 0 (map sq (filter odd (map inc (range 64))))",
+};
+
+/* Summing over the first 1000 numbers with a lambda calling itself, a fold over a range, and a loop */
+static char* counts = "def {count squares} (\\ {n x} {if n (count (- n 1) (+ x n)) x}) "
+                      "(\\ {n x} {if n (squares (- n 1) (+ x (sq n))) x})";
+
+static char* loops[][3] = {
+  { "count 1000 0",   "fold + 0 (range 1000)",                        "dotimes {i x} 1000 0 {+ x i}"      },
+  { "squares 1000 0", "fold (\\ {x i} {+ x (sq i)}) 0 (range 1000)", "dotimes {i x} 1000 0 {+ x (sq i)}" },
+};
+
+/* Choosing a Q-Expression and evaluating it, through a name bound to if, against the special form */
+static char* branches[][2] = {
+  { "eval (pick a {* a b} {/ a b})",          "if a (* a b) (/ a b)"          },
+  { "eval (pick (- a 7) {* a b} {/ a b})",    "if (- a 7) (* a b) (/ a b)"    },
+  { "eval (pick a {head {a b}} {tail {a b}})", "if a (head {a b}) (tail {a b})" },
+};
+
+/* Code bound to a name and evaluated: copied first as eval was once always given it, run as compiled before, and inline */
+static char* quotes = "def {c1 c2 c3} {+ a 1} {+ (* a a) (- b 1) (* 2 a b)} {if (- a 7) (head {a b}) (tail {a b})}";
+
+static char* evals[][3] = {
+  { "eval (join c1)", "eval c1", "+ a 1"                            },
+  { "eval (join c2)", "eval c2", "+ (* a a) (- b 1) (* 2 a b)"      },
+  { "eval (join c3)", "eval c3", "if (- a 7) (head {a b}) (tail {a b})" },
+};
+
+/*
+** Independent recursive calls as the arguments of one call, each with two more
+** as its own, and the same split by hand into futures down to a given depth
+*/
+static char* fibs = "def {fib pfib} (\\ {n} {if (- n 1) (if n (+ (fib (- n 1)) (fib (- n 2))) 0) 1}) "
+  "(\\ {d n} {if d (+ (await (spawn pfib (- d 1) (- n 1))) (pfib (- d 1) (- n 2))) (fib n)})";
+/* Calls failing on an argument before others costly to evaluate, and one that doesn't fail */
+static char* failing[] = {
+  "+ (/ a (- a a)) (fib 15)",
+  "list (head {}) (fib 12) (fib 12) (fib 12)",
+  "join (tail {}) (map fib {10 11 12})",
+  "+ (/ a b) (fib 15)",
+};
+
+static char* forks = "+ (fib 22) (fib 22) (fib 22) (fib 22)";
+static char* spawns = "pfib 6 24";
+
+/* The same call on each of a list of 64 numbers */
+static char* pmaps = "pmap fib ys";
+
+ival* bench_parse(mpc_parser_t* p, char* s) {
+  mpc_result_t r;
+  if (!mpc_parse("<bench>", s, p, &r)) {
+    mpc_err_print(r.error);
+    mpc_err_delete(r.error);
+    return NULL;
+  }
+  ival* v = ival_read(r.output);
+  mpc_ast_delete(r.output);
+  return v;
+}
+
+/* Compile once and time running it, taking ownership of the program */
+double bench_vm(ienv* e, ival* tree, int iterations) {
+  ichunk* c = ival_compile(e, tree);
+  clock_t start = clock();
+  for (int i = 0; i < iterations; i++) { ival_del(ivm_run(e, c)); }
+  double t = elapsed_ns(start, iterations);
+  ichunk_del(c);
+  return t;
+}
+
+static double wall_ms(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+/* Time a program by the clock on the wall, with fib defined afresh so its body is compiled knowing if there are threads to use */
+static double bench_wall(ienv* e, mpc_parser_t* p, char* program, int iterations) {
+  ival_del(ival_eval(e, bench_parse(p, fibs)));
+  ichunk* c = ival_compile(e, bench_parse(p, program));
+  double start = wall_ms();
+  for (int i = 0; i < iterations; i++) { ival_del(ivm_run(e, c)); }
+  double t = (wall_ms() - start) / iterations;
+  ichunk_del(c);
+  return t;
+}
+
+/* Time the same work spread over more and more threads, against a baseline on one thread, or the work itself */
+void bench_threads(ienv* e, mpc_parser_t* p, char* program, char* baseline, int max, int iterations) {
+  double t_one = 0;
+  if (baseline) {
+    t_one = bench_wall(e, p, baseline, iterations);
+    printf("%-34s %12.2f %12.2f\n", baseline, t_one, 1.0);
+  }
+
+  for (int n = 1; n <= max; n = n < max && n * 2 > max ? max : n * 2) {
+    if (n > 1 && !ipool_start(n)) { break; }
+    double t = bench_wall(e, p, program, iterations);
+    ipool_stop();
+    if (!baseline && n == 1) { t_one = t; }
+    printf("%-4i threads %21.2f %12.2f\n", n, t, t_one / t);
+  }
+}
+
+/*
+** An edit-heavy session: 8 inputs, then 64 definitions each made from one of
+** them and the definition 8 before it, with the inputs edited in turn. Each
+** edit reruns every definition, or just those made from the input in reactive mode.
+*/
+#define BENCH_INPUTS 8
+#define BENCH_DEFS 64
+
+static char* bench_def(char* s, int i) {
+  if (i < BENCH_INPUTS) { sprintf(s, "def {a%i} %i", i, i); }
+  else if (i < 2 * BENCH_INPUTS) { sprintf(s, "def {d%i} (+ (fib 12) a%i)", i, i % BENCH_INPUTS); }
+  else { sprintf(s, "def {d%i} (+ (fib 12) a%i d%i)", i, i % BENCH_INPUTS, i - BENCH_INPUTS); }
+  return s;
+}
+
+void bench_react(mpc_parser_t* p, int edits) {
+  char s[64];
+  double t[2];
+  for (int reactive = 0; reactive < 2; reactive++) {
+    ienv* e = ienv_new();
+    ienv_add_builtins(e);
+    if (reactive) { ireact_start(e); }
+    ival_del(ival_eval(e, bench_parse(p, fibs)));
+    for (int i = 0; i < BENCH_INPUTS + BENCH_DEFS; i++) { ival_del(ireact_eval(e, bench_parse(p, bench_def(s, i)))); }
+
+    clock_t start = clock();
+    for (int k = 0; k < edits; k++) {
+      sprintf(s, "def {a%i} %i", k % BENCH_INPUTS, k);
+      ival_del(ireact_eval(e, bench_parse(p, s)));
+      for (int i = BENCH_INPUTS; i < BENCH_INPUTS + BENCH_DEFS && !reactive; i++) {
+        ival_del(ival_eval(e, bench_parse(p, bench_def(s, i))));
+      }
+    }
+    t[reactive] = elapsed_ns(start, edits) / 1e6;
+
+    if (reactive) {
+      ireact* r = e->react;
+      printf("%-22s %12.3f %12.3f %11.1f%%\n", "64 definitions", t[0], t[1],
+        100.0 * r->skipped / (r->ran + r->skipped));
+    }
+    ienv_del(e);
+  }
+}
+
+/* Time running a program a slice of fuel at a time, as a host interleaving it with other work would */
+double bench_slices(ienv* e, mpc_parser_t* p, char* program, long fuel, int iterations) {
+  clock_t start = clock();
+  for (int i = 0; i < iterations; i++) {
+    irun* r = irun_new(e, bench_parse(p, program));
+    ival* x;
+    while (!(x = irun_resume(r, fuel))) {}
+    ival_del(x);
+    irun_del(r);
+  }
+  return elapsed_ns(start, iterations) / 1e6;
+}
+
+int main(int argc, char** argv) {
+  mpc_parser_t* Number   = mpc_new("number");
+  mpc_parser_t* Symbol   = mpc_new("symbol");
+  mpc_parser_t* Sexpr    = mpc_new("sexpr");
+  mpc_parser_t* Qexpr    = mpc_new("qexpr");
+  mpc_parser_t* Expr     = mpc_new("expr");
+  mpc_parser_t* Igor     = mpc_new("igor");
+
+  mpca_lang(MPC_LANG_DEFAULT,
+    "                                                   \
+    number : /-?[0-9]+/ ;                               \
+    symbol : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ;         \
+    sexpr  : '(' <expr>* ')' ;                          \
+    qexpr  : '{' <expr>* '}' ;                          \
+    expr   : <number> | <symbol> | <sexpr> | <qexpr> ;  \
+    igor   : /^/ <expr>* /$/ ; \
+    ",
+    Number, Symbol, Sexpr, Qexpr, Expr, Igor);
+
+  int iterations = argc > 1 ? atoi(argv[1]) : 200000;
+  int threads = argc > 2 ? atoi(argv[2]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+  ienv* e = ienv_new();
+  ienv_add_builtins(e);
+  ival* k = ival_sym("a"); ival* v = ival_num(7);  ienv_put(e, k, v); ival_del(k); ival_del(v);
+  k = ival_sym("b"); v = ival_num(13); ienv_put(e, k, v); ival_del(k); ival_del(v);
+
+  printf("%-50s %12s %12s %12s %12s\n", "program (ns/iteration)", "walk", "compile+vm", "vm", "vm+jit");
+
+  for (int p = 0; p < sizeof(programs) / sizeof(programs[0]); p++) {
+    mpc_result_t r;
+    if (!mpc_parse("<bench>", programs[p], Igor, &r)) {
+      mpc_err_print(r.error);
+      mpc_err_delete(r.error);
+      continue;
+    }
+    ival* tree = ival_read(r.output);
+    mpc_ast_delete(r.output);
+
+    /* Tree walker, which consumes its input so needs a fresh copy each time */
+    clock_t start = clock();
+    for (int i = 0; i < iterations; i++) { ival_del(walk(e, ival_copy(tree))); }
+    double t_walk = elapsed_ns(start, iterations);
+
+    /* Compiling every time, as eval of fresh input does */
+    start = clock();
+    for (int i = 0; i < iterations; i++) {
+      ichunk* c = ival_compile(e, ival_copy(tree));
+      ival_del(ivm_run(e, c));
+      ichunk_del(c);
+    }
+    double t_compile = elapsed_ns(start, iterations);
+
+    /* Compiling once and running many times, with and without native arithmetic */
+    ijit_enabled = 0;
+    ichunk* c = ival_compile(e, ival_copy(tree));
+    start = clock();
+    for (int i = 0; i < iterations; i++) { ival_del(ivm_run(e, c)); }
+    double t_vm = elapsed_ns(start, iterations);
+    ichunk_del(c);
+
+    ijit_enabled = 1;
+    c = ival_compile(e, tree);
+    start = clock();
+    for (int i = 0; i < iterations; i++) { ival_del(ivm_run(e, c)); }
+    double t_jit = elapsed_ns(start, iterations);
+    ichunk_del(c);
+
+    printf("%-50s %12.1f %12.1f %12.1f %12.1f\n", programs[p], t_walk, t_compile, t_vm, t_jit);
+  }
+
+  /* Through the builtins, fused on numbers kept in C, and as native code */
+  printf("\n%-50s %12s %12s %12s\n", "ns/run", "boxed", "fused", "native");
+  for (int i = 0; i < sizeof(sums) / sizeof(sums[0]); i++) {
+    ijit_enabled = 0;
+    iarith_enabled = 0;
+    double t_boxed = bench_vm(e, bench_parse(Igor, sums[i]), iterations);
+    iarith_enabled = 1;
+    double t_fused = bench_vm(e, bench_parse(Igor, sums[i]), iterations);
+    ijit_enabled = 1;
+    double t_native = bench_vm(e, bench_parse(Igor, sums[i]), iterations);
+    printf("%-50s %12.1f %12.1f %12.1f\n", sums[i], t_boxed, t_fused, t_native);
+  }
+
+  /* Through the builtins' checked entries and the ones the compiler has proven safe, with arithmetic left to them */
+  ijit_enabled = 0;
+  iarith_enabled = 0;
+  printf("\n%-50s %12s %12s\n", "ns/run", "checked", "proven");
+  for (int i = 0; i < sizeof(proofs) / sizeof(proofs[0]); i++) {
+    iproven_enabled = 0;
+    double t_checked = bench_vm(e, bench_parse(Igor, proofs[i]), iterations);
+    iproven_enabled = 1;
+    double t_proven = bench_vm(e, bench_parse(Igor, proofs[i]), iterations);
+    printf("%-50s %12.1f %12.1f\n", proofs[i], t_checked, t_proven);
+  }
+  ijit_enabled = 1;
+  iarith_enabled = 1;
+
+  ival_del(ival_eval(e, bench_parse(Igor, lambdas)));
+  printf("\n%-22s %12s %12s\n", "ns/call", "builtin", "lambda");
+  for (int i = 0; i < sizeof(calls) / sizeof(calls[0]); i++) {
+    double t_builtin = bench_vm(e, bench_parse(Igor, calls[i][0]), iterations);
+    double t_lambda = bench_vm(e, bench_parse(Igor, calls[i][1]), iterations);
+    printf("%-22s %12.1f %12.1f\n", calls[i][1], t_builtin, t_lambda);
+  }
+
+  ival_del(ival_eval(e, bench_parse(Igor, memos)));
+  printf("\n%-22s %12s %12s\n", "ns/call", "lambda", "memo hit");
+  double t_rows = bench_vm(e, bench_parse(Igor, "rows a b"), iterations);
+  double t_mrows = bench_vm(e, bench_parse(Igor, "mrows a b"), iterations);
+  printf("%-22s %12.1f %12.1f\n", "rows a b", t_rows, t_mrows);
+
+  ival_del(ival_eval(e, bench_parse(Igor, "def {pick} if")));
+  printf("\n%-40s %12s %12s\n", "ns/conditional", "eval", "if");
+  for (int i = 0; i < sizeof(branches) / sizeof(branches[0]); i++) {
+    double t_eval = bench_vm(e, bench_parse(Igor, branches[i][0]), iterations);
+    double t_if = bench_vm(e, bench_parse(Igor, branches[i][1]), iterations);
+    printf("%-40s %12.1f %12.1f\n", branches[i][1], t_eval, t_if);
+  }
+
+  ival_del(ival_eval(e, bench_parse(Igor, quotes)));
+  printf("\n%-40s %12s %12s %12s\n", "ns/eval", "copied", "kept", "inline");
+  for (int i = 0; i < sizeof(evals) / sizeof(evals[0]); i++) {
+    double t_copied = bench_vm(e, bench_parse(Igor, evals[i][0]), iterations);
+    double t_kept = bench_vm(e, bench_parse(Igor, evals[i][1]), iterations);
+    double t_inline = bench_vm(e, bench_parse(Igor, evals[i][2]), iterations);
+    printf("%-40s %12.1f %12.1f %12.1f\n", evals[i][1], t_copied, t_kept, t_inline);
+  }
+
+  ival_del(ival_eval(e, bench_parse(Igor, pipes)));
+  char xs[512] = "def {xs} {";
+  for (int i = 0; i < 64; i++) { snprintf(xs + strlen(xs), sizeof(xs) - strlen(xs), i ? " %i" : "%i", i); }
+  strcat(xs, "}");
+  ival_del(ival_eval(e, bench_parse(Igor, xs)));
+  printf("\n%-56s %12s %12s\n", "ns/element", "calls", "fused");
+  for (int i = 0; i < sizeof(chains) / sizeof(chains[0]); i++) {
+    ifuse_enabled = 0;
+    double t_calls = bench_vm(e, bench_parse(Igor, chains[i]), iterations / 64);
+    ifuse_enabled = 1;
+    double t_fused = bench_vm(e, bench_parse(Igor, chains[i]), iterations / 64);
+    printf("%-56s %12.1f %12.1f\n", chains[i], t_calls / 64, t_fused / 64);
+  }
+
+  ival_del(ival_eval(e, bench_parse(Igor, counts)));
+  printf("\n%-34s %12s %12s %12s\n", "ns/step", "recursion", "fold", "dotimes");
+  for (int i = 0; i < sizeof(loops) / sizeof(loops[0]); i++) {
+    double t_recursion = bench_vm(e, bench_parse(Igor, loops[i][0]), iterations / 1000);
+    double t_fold = bench_vm(e, bench_parse(Igor, loops[i][1]), iterations / 1000);
+    double t_dotimes = bench_vm(e, bench_parse(Igor, loops[i][2]), iterations / 1000);
+    printf("%-34s %12.1f %12.1f %12.1f\n", loops[i][2], t_recursion / 1000, t_fold / 1000, t_dotimes / 1000);
+  }
+
+  printf("\n%-22s %12s %12s\n", "ns/operand", "builtin_op", "kernel");
+  int sizes[] = { 2, 8, 64 };
+  for (int i = 0; i < 3; i++) {
+    bench_operands(e, "+", builtin_add, sizes[i], iterations);
+    bench_operands(e, "*", builtin_mul, sizes[i], iterations);
+  }
+
+  printf("\n%-22s %12s %12s\n", "ns/element", "list", "range");
+  for (int i = 0; i < 3; i++) { bench_range(e, sizes[i] * 16, iterations / 16); }
+
+  printf("\n%-22s %12s %12s\n", "ns/error", "formatted", "deferred");
+  bench_errors(iterations);
+
+  int runs = iterations / 20000 > 0 ? iterations / 20000 : 1;
+  ival_del(ival_eval(e, bench_parse(Igor, fibs)));
+  printf("\n%-22s %12s %12s %12s %12s\n", "ms/run", "unmetered", "sliced 100", "sliced 10k", "one slice");
+  double t_plain = bench_slices(e, Igor, "fib 20", LONG_MAX, runs);
+  double t_100 = bench_slices(e, Igor, "fib 20", 100, runs);
+  double t_10k = bench_slices(e, Igor, "fib 20", 10000, runs);
+  printf("%-22s %12.2f %12.2f %12.2f %12.2f\n", "fib 20", bench_vm(e, bench_parse(Igor, "fib 20"), runs) / 1e6,
+    t_100, t_10k, t_plain);
+
+  /* Compiled with and without skipping what's left of a call once an argument fails */
+  printf("\n%-50s %12s %12s\n", "us/run", "strict", "fail-fast");
+  for (int i = 0; i < sizeof(failing) / sizeof(failing[0]); i++) {
+    ibail_enabled = 0;
+    double t_strict = bench_vm(e, bench_parse(Igor, failing[i]), runs * 10);
+    ibail_enabled = 1;
+    double t_bail = bench_vm(e, bench_parse(Igor, failing[i]), runs * 10);
+    printf("%-50s %12.2f %12.2f\n", failing[i], t_strict / 1e3, t_bail / 1e3);
+  }
+
+  printf("\n%-22s %12s %12s %12s\n", "ms/edit", "rerun", "reactive", "skipped");
+  bench_react(Igor, runs * 8);
+
+  printf("\n%-34s %12s %12s\n", forks, "ms/run", "speedup");
+  bench_threads(e, Igor, forks, NULL, threads, runs);
+
+  printf("\n%-34s %12s %12s\n", spawns, "ms/run", "speedup");
+  bench_threads(e, Igor, spawns, NULL, threads, runs);
+
+  char ys[512] = "def {ys} {";
+  for (int i = 0; i < 64; i++) { strcat(ys, i ? " 16" : "16"); }
+  strcat(ys, "}");
+  ival_del(ival_eval(e, bench_parse(Igor, ys)));
+  printf("\n%-34s %12s %12s\n", pmaps, "ms/run", "speedup");
+  bench_threads(e, Igor, pmaps, "map fib ys", threads, runs);
+
+  ienv_del(e);
+  mpc_cleanup(6, Number, Symbol, Sexpr, Qexpr, Expr, Igor);
+  return 0;
+}
@@ -1,8 +1,14 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <signal.h>
 
 #include "../lib/mpc.h"
 #include "parse.h"
+#include "opt.h"
+#include "jit.h"
+#include "par.h"
+#include "vm.h"
+#include "react.h"
 
 #ifdef _WIN32
 #include <string.h>
@@ -22,6 +28,37 @@ void add_history(char* unused) {}
 #include <editline/history.h>
 #endif // _WIN32
 
+/* Read a line of any length, without its newline, or NULL at the end of the file */
+static char* read_line(FILE* f) {
+  int len = 0;
+  int cap = 128;
+  char* s = malloc(cap);
+  int c;
+  while ((c = fgetc(f)) != EOF && c != '\n') {
+    if (len + 1 >= cap) { cap *= 2; s = realloc(s, cap); }
+    s[len++] = c;
+  }
+  if (c == EOF && len == 0) {
+    free(s);
+    return NULL;
+  }
+  s[len] = '\0';
+  return s;
+}
+
+/* How much of the work of running everything again redefinitions saved */
+static void react_report(ienv* e) {
+  ireact* r = e->react;
+  if (!r || !r->edits) { return; }
+  fprintf(stderr, "%li edits recomputed %li definitions and skipped %li, %.1f%% of them\n",
+    r->edits, r->ran, r->skipped, 100.0 * r->skipped / (r->ran + r->skipped > 0 ? r->ran + r->skipped : 1));
+}
+
+/* Ctrl-C while evaluating gives up on the expression, rather than the whole session */
+static void on_interrupt(int sig) {
+  ival_interrupt(1);
+}
+
 int main(int argc, char** argv) {
   mpc_parser_t* Number   = mpc_new("number");
   mpc_parser_t* Symbol   = mpc_new("symbol");
@@ -41,13 +78,68 @@ int main(int argc, char** argv) {
     ",
     Number, Symbol, Sexpr, Qexpr, Expr, Igor);
 
-  puts("Igor Version 0.0.1");
+  char* file = NULL;
+  int threads = 1;
+  int reactive = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--no-jit") == 0) { ijit_enabled = 0; }
+    else if (strcmp(argv[i], "--no-fuse") == 0) { ifuse_enabled = 0; }
+    else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) { threads = atoi(argv[++i]); }
+    else if (strcmp(argv[i], "--fuel") == 0 && i + 1 < argc) { ival_fuel = atol(argv[++i]); }
+    else if (strcmp(argv[i], "--reactive") == 0) { reactive = 1; }
+    else if (strcmp(argv[i], "--strict") == 0) { ibail_enabled = 0; }
+    else { file = argv[i]; }
+  }
+
+  /* Costly arguments of a call are evaluated at once on other threads */
+  if (threads > 1 && !ipool_start(threads)) { fprintf(stderr, "Could not start %i threads\n", threads); }
 
   ienv* e = ienv_new();
   ienv_add_builtins(e);
 
+  /* Redefining a symbol recomputes the definitions made from it */
+  if (reactive) { ireact_start(e); }
+
+  /* Given a file, run it a line at a time exactly as the REPL would instead of starting the REPL */
+  if (file) {
+    FILE* f = fopen(file, "r");
+    if (!f) {
+      perror(file);
+      return 1;
+    }
+    char* line;
+    while ((line = read_line(f))) {
+      mpc_result_t r;
+      ival* deep = NULL;
+      if (line[strspn(line, " \t\r")] == '\0') {
+        /* Blank */
+      } else if ((deep = ival_read_depth(line))) {
+        ival_println(deep);
+        ival_del(deep);
+      } else if (mpc_parse(file, line, Igor, &r)) {
+        ival* x = ireact_eval(e, ival_read(r.output));
+        mpc_ast_delete(r.output);
+        ival_println(x);
+        ival_del(x);
+      } else {
+        mpc_err_print(r.error);
+        mpc_err_delete(r.error);
+      }
+      free(line);
+    }
+    fclose(f);
+    ipool_stop();
+    react_report(e);
+    ienv_del(e);
+    mpc_cleanup(6, Number, Symbol, Sexpr, Qexpr, Expr, Igor);
+    return 0;
+  }
+
+  puts("Igor Version 0.0.1");
+
   while(1) {
     char* input = readline("igor> ");
+    if(!input) break;
     if(strstr(input, "exit")) break;
     if(strstr(input, "help")) {
       printf("Igor current support reverse poslish notation with integer numbers\n");
@@ -55,8 +147,17 @@ int main(int argc, char** argv) {
     }
     add_history(input);
     mpc_result_t r;
-    if(mpc_parse("<stdin>", input, Igor, &r)) {
-      ival* x = ival_eval(e, ival_read(r.output));
+    ival* deep = ival_read_depth(input);
+    if (deep) {
+      ival_println(deep);
+      ival_del(deep);
+    } else if(mpc_parse("<stdin>", input, Igor, &r)) {
+      /* Compile the line once, then run it, giving up on it if it runs out of fuel or is interrupted */
+      ival_interrupt(0);
+      signal(SIGINT, on_interrupt);
+      ival* x = ireact_eval(e, ival_read(r.output));
+      signal(SIGINT, SIG_DFL);
+      mpc_ast_delete(r.output);
       ival_println(x);
       ival_del(x);
     } else {
@@ -65,6 +166,8 @@ int main(int argc, char** argv) {
     }
     free(input);
   }
+  ipool_stop();
+  react_report(e);
   ienv_del(e);
 
   mpc_cleanup(6, Number, Symbol, Sexpr, Qexpr, Expr, Igor);
@@ -0,0 +1,683 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include "../lib/mpc.h"
+#include "parse.h"
+#include "opt.h"
+
+/* Where the runtime headers and library live, the makefile points these at the build */
+#ifndef IGOR_INCLUDE
+#define IGOR_INCLUDE "src"
+#endif
+#ifndef IGOR_LIB
+#define IGOR_LIB "bin"
+#endif
+
+/* Growable text buffer */
+
+typedef struct icbuf {
+  char* s;
+  int len;
+  int cap;
+} icbuf;
+
+void icbuf_printf(icbuf* b, char* fmt, ...) {
+  va_list va;
+  va_start(va, fmt);
+  int n = vsnprintf(NULL, 0, fmt, va);
+  va_end(va);
+
+  if (b->len + n + 1 > b->cap) {
+    b->cap = (b->len + n + 1) * 2;
+    b->s = realloc(b->s, b->cap);
+  }
+
+  va_start(va, fmt);
+  vsnprintf(b->s + b->len, n + 1, fmt, va);
+  va_end(va);
+  b->len += n;
+}
+
+/* Builtins generated code may call directly */
+
+static struct { ibuiltin f; char* name; } icbuiltins[] = {
+  { builtin_def,  "builtin_def"  }, { builtin_list, "builtin_list" },
+  { builtin_head, "builtin_head" }, { builtin_tail, "builtin_tail" },
+  { builtin_eval, "builtin_eval" }, { builtin_join, "builtin_join" },
+  { builtin_add,  "builtin_add"  }, { builtin_sub,  "builtin_sub"  },
+  { builtin_mul,  "builtin_mul"  }, { builtin_div,  "builtin_div"  },
+  { builtin_lambda, "builtin_lambda" }, { builtin_memo, "builtin_memo" },
+  { builtin_memo_stats, "builtin_memo_stats" }, { builtin_range, "builtin_range" },
+  { builtin_iterate, "builtin_iterate" }, { builtin_map, "builtin_map" },
+  { builtin_filter, "builtin_filter" }, { builtin_fold, "builtin_fold" },
+  { builtin_reduce, "builtin_reduce" }, { builtin_pmap, "builtin_pmap" },
+  { builtin_preduce, "builtin_preduce" }, { builtin_spawn, "builtin_spawn" },
+  { builtin_await, "builtin_await" },
+};
+
+char* icbuiltin_name(ibuiltin f) {
+  for (int i = 0; i < sizeof(icbuiltins) / sizeof(icbuiltins[0]); i++) {
+    if (icbuiltins[i].f == f) { return icbuiltins[i].name; }
+  }
+  return NULL;
+}
+
+/* Code Generation */
+
+typedef struct igen {
+  /* A fresh environment, showing what every symbol starts out bound to */
+  ienv* e;
+
+  /* Every symbol that appears quoted. Only quoted symbols can be passed to def,
+     so any builtin not among them keeps its binding for the whole script */
+  ival* quoted;
+
+  /* Symbols the generated code looks up, declared once at the top */
+  ival* syms;
+
+  icbuf body;
+  int temps;
+  int labels;
+} igen;
+
+/* Find every symbol inside a Q-Expression anywhere in the program */
+void igen_quoted(igen* g, ival* prog) {
+  iwork w;
+  iwork_init(&w);
+  iwork_push(&w, prog);
+  iwork_push(&w, (void*)0);
+
+  while (w.count) {
+    int quoted = (int)(intptr_t)iwork_pop(&w);
+    ival* v = iwork_pop(&w);
+    if (v->type == IVAL_SYM && quoted) { ival_add(g->quoted, ival_copy(v)); }
+    if (v->type == IVAL_SEXPR || v->type == IVAL_QEXPR) {
+      for (int i = 0; i < v->count; i++) {
+        iwork_push(&w, v->cell[i]);
+        iwork_push(&w, (void*)(intptr_t)(quoted || v->type == IVAL_QEXPR));
+      }
+    }
+  }
+
+  iwork_free(&w);
+}
+
+/* The builtin a symbol is bound to for the whole script, or NULL */
+ibuiltin igen_fixed(igen* g, ival* k) {
+  if (k->type != IVAL_SYM) { return NULL; }
+  for (int i = 0; i < g->quoted->count; i++) {
+    if (strcmp(g->quoted->cell[i]->sym, k->sym) == 0) { return NULL; }
+  }
+  return ienv_builtin(g->e, k);
+}
+
+/* The arithmetic operator of a call to a fixed builtin, or 0 */
+char igen_arith(igen* g, ival* v) {
+  if (v->type != IVAL_SEXPR || v->count < 2) { return 0; }
+  ibuiltin f = igen_fixed(g, v->cell[0]);
+  if (f == builtin_add) { return '+'; }
+  if (f == builtin_sub) { return '-'; }
+  if (f == builtin_mul) { return '*'; }
+  if (f == builtin_div) { return '/'; }
+  return 0;
+}
+
+/* Index of the declaration holding a symbol */
+int igen_sym(igen* g, ival* k) {
+  for (int i = 0; i < g->syms->count; i++) {
+    if (strcmp(g->syms->cell[i]->sym, k->sym) == 0) { return i; }
+  }
+  ival_add(g->syms, ival_copy(k));
+  return g->syms->count-1;
+}
+
+/* Print a symbol as a C string literal */
+void igen_string(icbuf* b, char* s) {
+  icbuf_printf(b, "\"");
+  for (; *s; s++) { icbuf_printf(b, *s == '\\' ? "\\\\" : "%c", *s); }
+  icbuf_printf(b, "\"");
+}
+
+/* Write a number as a C literal, the most negative long having none of its own */
+void igen_long(char* buf, int n, long x) {
+  if (x == LONG_MIN) { snprintf(buf, n, "(-%liL - 1)", LONG_MAX); }
+  else { snprintf(buf, n, "%liL", x); }
+}
+
+/* Build a quoted value, returning the temporary holding it */
+int igen_quote(igen* g, ival* v) {
+
+  /* Pairs of (value, children done), built bottom up */
+  iwork w, ids;
+  iwork_init(&w);
+  iwork_init(&ids);
+  iwork_push(&w, v);
+  iwork_push(&w, (void*)0);
+
+  while (w.count) {
+    int done = (int)(intptr_t)iwork_pop(&w);
+    v = iwork_pop(&w);
+
+    /* Lists go round twice, first to push their children */
+    if ((v->type == IVAL_SEXPR || v->type == IVAL_QEXPR) && !done) {
+      iwork_push(&w, v);
+      iwork_push(&w, (void*)1);
+      for (int i = v->count-1; i >= 0; i--) {
+        iwork_push(&w, v->cell[i]);
+        iwork_push(&w, (void*)0);
+      }
+      continue;
+    }
+
+    int t = g->temps++;
+    switch (v->type) {
+      case IVAL_NUM: {
+        char num[32];
+        igen_long(num, 32, v->num);
+        icbuf_printf(&g->body, "  ival* t%i = ival_num(%s);\n", t, num);
+      }
+      break;
+      case IVAL_SYM:
+        icbuf_printf(&g->body, "  ival* t%i = ival_sym(", t);
+        igen_string(&g->body, v->sym);
+        icbuf_printf(&g->body, ");\n");
+      break;
+      /* Such as a number too big to read, which stays an error inside the list */
+      case IVAL_ERR:
+        icbuf_printf(&g->body, "  ival* t%i = ival_err(", t);
+        igen_string(&g->body, v->err->fmt);
+        for (int i = 0; i < v->err->nargs; i++) {
+          char num[32];
+          icbuf_printf(&g->body, ", ");
+          if (v->err->kinds[i] == 's') { igen_string(&g->body, v->err->text + v->err->args[i]); continue; }
+          igen_long(num, 32, v->err->kinds[i] == 'l' ? v->err->args[i] : (int)v->err->args[i]);
+          icbuf_printf(&g->body, v->err->kinds[i] == 'l' ? "%s" : "(int)%s", num);
+        }
+        icbuf_printf(&g->body, ");\n");
+      break;
+      case IVAL_SEXPR:
+      case IVAL_QEXPR:
+        icbuf_printf(&g->body, "  ival* t%i = %s();\n", t, v->type == IVAL_SEXPR ? "ival_sexpr" : "ival_qexpr");
+        ids.count -= v->count;
+        for (int i = 0; i < v->count; i++) {
+          icbuf_printf(&g->body, "  ival_add(t%i, t%i);\n", t, (int)(intptr_t)ids.items[ids.count + i]);
+        }
+      break;
+    }
+    iwork_push(&ids, (void*)(intptr_t)t);
+  }
+
+  int t = (int)(intptr_t)iwork_pop(&ids);
+  iwork_free(&w);
+  iwork_free(&ids);
+  return t;
+}
+
+/* Print the temporaries in ids[from..from+n) as an array initialiser */
+void igen_array(igen* g, iwork* ids, int from, int n) {
+  icbuf_printf(&g->body, "{");
+  for (int i = 0; i < n; i++) {
+    icbuf_printf(&g->body, i ? ", t%i" : "t%i", (int)(intptr_t)ids->items[from + i]);
+  }
+  icbuf_printf(&g->body, "}");
+}
+
+/*
+** An arithmetic tree whose non-arithmetic leaves are already in temporaries.
+** When every leaf turns out to be a number the whole tree runs on longs, with
+** wrapping arithmetic like the interpreter. Otherwise, or on a divisor of 0 or
+** -1, each operator is called in turn exactly as the interpreter would.
+*/
+void igen_arith_tree(igen* g, ival* v, int* leaves, int nleaves, int t) {
+  int label = g->labels++;
+  icbuf* b = &g->body;
+
+  icbuf_printf(b, "  ival* t%i;\n  {\n", t);
+  for (int i = 0; i < nleaves; i++) {
+    icbuf_printf(b, "    if (t%i->type != IVAL_NUM) { goto slow%i; }\n", leaves[i], label);
+  }
+
+  /* Both passes walk the tree bottom up, operands being "L<n>" literals, "T<n>" leaves or "U<n>" results */
+  for (int pass = 0; pass < 2; pass++) {
+    iwork w, ops;
+    iwork_init(&w);
+    iwork_init(&ops);
+    iwork_push(&w, v);
+    iwork_push(&w, (void*)0);
+    int leaf = 0;
+    int u = 0;
+
+    if (pass == 1) { icbuf_printf(b, "  }\n  slow%i: {\n", label); }
+
+    while (w.count) {
+      int done = (int)(intptr_t)iwork_pop(&w);
+      ival* x = iwork_pop(&w);
+      char op = igen_arith(g, x);
+
+      if (!op) {
+        char* d = malloc(32);
+        if (x->type == IVAL_NUM) { d[0] = 'L'; igen_long(d + 1, 31, x->num); }
+        else { snprintf(d, 32, "T%i", leaves[leaf++]); }
+        iwork_push(&ops, d);
+        continue;
+      }
+
+      if (!done) {
+        iwork_push(&w, x);
+        iwork_push(&w, (void*)1);
+        for (int i = x->count-1; i >= 1; i--) {
+          iwork_push(&w, x->cell[i]);
+          iwork_push(&w, (void*)0);
+        }
+        continue;
+      }
+
+      int n = x->count-1;
+      ops.count -= n;
+      char** args = (char**)(ops.items + ops.count);
+
+      if (pass == 0) {
+        /* Unboxed */
+        for (int i = 0; i < n; i++) {
+          char* a = args[i];
+          char val[48];
+          if (a[0] == 'L') { snprintf(val, 48, "%s", a + 1); }
+          else if (a[0] == 'T') { snprintf(val, 48, "t%s->num", a + 1); }
+          else { snprintf(val, 48, "u%s", a + 1); }
+
+          if (i == 0) {
+            icbuf_printf(b, "    long u%i = %s;\n", u, val);
+            if (n == 1 && op == '-') { icbuf_printf(b, "    u%i = (long)(0UL - (unsigned long)u%i);\n", u, u); }
+            continue;
+          }
+          if (op == '/') {
+            icbuf_printf(b, "    if (%s == 0 || %s == -1) { goto slow%i; }\n", val, val, label);
+            icbuf_printf(b, "    u%i = u%i / %s;\n", u, u, val);
+          } else {
+            icbuf_printf(b, "    u%i = (long)((unsigned long)u%i %c (unsigned long)%s);\n", u, u, op, val);
+          }
+        }
+      } else {
+        /* Boxed, one builtin call per operator */
+        icbuf_printf(b, "    ival* u%i;\n    { ival* a[] = {", u);
+        for (int i = 0; i < n; i++) {
+          char* a = args[i];
+          if (i) { icbuf_printf(b, ", "); }
+          if (a[0] == 'L') { icbuf_printf(b, "ival_num(%s)", a + 1); }
+          else if (a[0] == 'T') { icbuf_printf(b, "t%s", a + 1); }
+          else { icbuf_printf(b, "u%s", a + 1); }
+        }
+        icbuf_printf(b, "};\n      ival* err = ivm_first_err(a, %i);\n", n);
+        icbuf_printf(b, "      u%i = err ? err : %s(e, ivm_args(a, %i)); }\n",
+          u, icbuiltin_name(igen_fixed(g, x->cell[0])), n);
+      }
+
+      for (int i = 0; i < n; i++) { free(args[i]); }
+      char* d = malloc(32);
+      snprintf(d, 32, "U%i", u++);
+      iwork_push(&ops, d);
+    }
+
+    if (pass == 0) {
+      for (int i = 0; i < nleaves; i++) { icbuf_printf(b, "    ival_del(t%i);\n", leaves[i]); }
+      icbuf_printf(b, "    t%i = ival_num(u%i);\n    goto done%i;\n", t, u-1, label);
+    } else {
+      icbuf_printf(b, "    t%i = u%i;\n  }\n  done%i:;\n", t, u-1, label);
+    }
+
+    free(iwork_pop(&ops));
+    iwork_free(&w);
+    iwork_free(&ops);
+  }
+}
+
+/* Generator work items */
+enum { IGEN_EXPR, IGEN_CALL, IGEN_ARITH, IGEN_TEST, IGEN_ELSE, IGEN_AND, IGEN_OR, IGEN_END };
+
+/*
+** Queue up the parts of a special form, or return 0 to generate it as a call.
+** Forms can't be redefined, so unlike other builtins they are known even when
+** quoted. The parts go in nested C blocks so only the branches taken run.
+*/
+int igen_form(igen* g, iwork* w, iwork* ids, ival* v, ibuiltin f) {
+  int n = v->count - 1;
+  if (f == builtin_if && n != 2 && n != 3) { return 0; }
+
+  if (f != builtin_if && n == 0) {
+    int t = g->temps++;
+    icbuf_printf(&g->body, "  ival* t%i = ival_num(%i);\n", t, f == builtin_and);
+    iwork_push(ids, (void*)(intptr_t)t);
+    return 1;
+  }
+
+  if (f != builtin_if && n == 1) {
+    iwork_push(w, v->cell[1]);
+    iwork_push(w, (void*)0);
+    iwork_push(w, (void*)IGEN_EXPR);
+    return 1;
+  }
+
+  /* The end closes a block for each test */
+  iwork_push(w, v);
+  iwork_push(w, (void*)(intptr_t)(f == builtin_if ? 2 : n - 1));
+  iwork_push(w, (void*)IGEN_END);
+
+  for (int i = n; i >= 1; i--) {
+    iwork_push(w, v->cell[i]);
+    iwork_push(w, (void*)0);
+    iwork_push(w, (void*)IGEN_EXPR);
+    if (i == 1) { break; }
+    iwork_push(w, v);
+    iwork_push(w, (void*)(intptr_t)i);
+    iwork_push(w, (void*)(intptr_t)(f == builtin_and ? IGEN_AND : f == builtin_or ? IGEN_OR : i == 2 ? IGEN_TEST : IGEN_ELSE));
+  }
+  return 1;
+}
+
+/* Generate code for one expression, returning the temporary holding its value */
+int igen_expr(igen* g, ival* v) {
+  icbuf* b = &g->body;
+
+  /* Triples of (expression, leaves, task); ids holds the temporaries produced so far */
+  iwork w, ids;
+  iwork_init(&w);
+  iwork_init(&ids);
+  iwork_push(&w, v);
+  iwork_push(&w, (void*)0);
+  iwork_push(&w, (void*)IGEN_EXPR);
+
+  while (w.count) {
+    int task = (int)(intptr_t)iwork_pop(&w);
+    int nleaves = (int)(intptr_t)iwork_pop(&w);
+    v = iwork_pop(&w);
+
+    if (task == IGEN_ARITH) {
+      int* leaves = malloc(sizeof(int) * (nleaves + 1));
+      ids.count -= nleaves;
+      for (int i = 0; i < nleaves; i++) { leaves[i] = (int)(intptr_t)ids.items[ids.count + i]; }
+      int t = g->temps++;
+      igen_arith_tree(g, v, leaves, nleaves, t);
+      iwork_push(&ids, (void*)(intptr_t)t);
+      free(leaves);
+      continue;
+    }
+
+    /* The condition of an if is in a temporary, which the result takes over if it is an error */
+    if (task == IGEN_TEST) {
+      int c = (int)(intptr_t)iwork_pop(&ids);
+      int t = g->temps++;
+      icbuf_printf(b, "  ival* t%i = t%i;\n  if (t%i->type != IVAL_ERR) {\n", t, c, t);
+      icbuf_printf(b, "  int b%i = ival_truthy(t%i);\n  ival_del(t%i);\n  if (b%i) {\n", t, t, t, t);
+      iwork_push(&ids, (void*)(intptr_t)t);
+      continue;
+    }
+
+    if (task == IGEN_ELSE) {
+      int x = (int)(intptr_t)iwork_pop(&ids);
+      int t = (int)(intptr_t)ids.items[ids.count-1];
+      icbuf_printf(b, "  t%i = t%i;\n  } else {\n", t, x);
+      continue;
+    }
+
+    /* The next argument of an and or an or runs only if this one doesn't decide the result */
+    if (task == IGEN_AND || task == IGEN_OR) {
+      int x = (int)(intptr_t)iwork_pop(&ids);
+      int t;
+      if (nleaves == 2) {
+        t = g->temps++;
+        icbuf_printf(b, "  ival* t%i = t%i;\n", t, x);
+        iwork_push(&ids, (void*)(intptr_t)t);
+      } else {
+        t = (int)(intptr_t)ids.items[ids.count-1];
+        icbuf_printf(b, "  t%i = t%i;\n", t, x);
+      }
+      icbuf_printf(b, "  if (t%i->type != IVAL_ERR && %sival_truthy(t%i)) {\n  ival_del(t%i);\n",
+        t, task == IGEN_AND ? "" : "!", t, t);
+      continue;
+    }
+
+    if (task == IGEN_END) {
+      int x = (int)(intptr_t)iwork_pop(&ids);
+      int t = (int)(intptr_t)ids.items[ids.count-1];
+      icbuf_printf(b, "  t%i = t%i;\n", t, x);
+      if (v->count == 3 && iscope_form(g->e, NULL, v->cell[0]) == builtin_if) {
+        icbuf_printf(b, "  } else {\n  t%i = ival_sexpr();\n", t);
+      }
+      for (int i = 0; i < nleaves; i++) { icbuf_printf(b, "  }\n"); }
+      continue;
+    }
+
+    if (task == IGEN_CALL) {
+      ibuiltin f = igen_fixed(g, v->cell[0]);
+      int direct = f && f != builtin_eval && v->count > 1 ? 1 : 0;
+      int n = v->count - direct;
+      ids.count -= n;
+      int t = g->temps++;
+
+      icbuf_printf(b, "  ival* t%i;\n  { ival* a[] = ", t);
+      igen_array(g, &ids, ids.count, n);
+      if (direct) {
+        icbuf_printf(b, ";\n    ival* err = ivm_first_err(a, %i);\n", n);
+        icbuf_printf(b, "    t%i = err ? err : %s(e, ivm_args(a, %i)); }\n", t, icbuiltin_name(f), n);
+      } else {
+        icbuf_printf(b, ";\n    t%i = ivm_call(e, a, %i); }\n", t, n);
+      }
+      iwork_push(&ids, (void*)(intptr_t)t);
+      continue;
+    }
+
+    int t;
+    switch (v->type) {
+      case IVAL_SYM:
+        t = g->temps++;
+        icbuf_printf(b, "  ival* t%i = ienv_get(e, s%i);\n", t, igen_sym(g, v));
+        iwork_push(&ids, (void*)(intptr_t)t);
+      break;
+
+      case IVAL_SEXPR:
+        if (v->count == 0) {
+          t = g->temps++;
+          icbuf_printf(b, "  ival* t%i = ival_sexpr();\n", t);
+          iwork_push(&ids, (void*)(intptr_t)t);
+          break;
+        }
+
+        ibuiltin form = v->cell[0]->type == IVAL_SYM ? iscope_form(g->e, NULL, v->cell[0]) : NULL;
+        if (form && igen_form(g, &w, &ids, v, form)) { break; }
+
+        /* Arithmetic trees evaluate their other leaves first, left to right */
+        if (igen_arith(g, v)) {
+          iwork leaves, stack;
+          iwork_init(&leaves);
+          iwork_init(&stack);
+          iwork_push(&stack, v);
+          while (stack.count) {
+            ival* x = iwork_pop(&stack);
+            if (igen_arith(g, x)) {
+              for (int i = x->count-1; i >= 1; i--) { iwork_push(&stack, x->cell[i]); }
+            } else if (x->type != IVAL_NUM) {
+              iwork_push(&leaves, x);
+            }
+          }
+          iwork_push(&w, v);
+          iwork_push(&w, (void*)(intptr_t)leaves.count);
+          iwork_push(&w, (void*)IGEN_ARITH);
+          for (int i = leaves.count-1; i >= 0; i--) {
+            iwork_push(&w, leaves.items[i]);
+            iwork_push(&w, (void*)0);
+            iwork_push(&w, (void*)IGEN_EXPR);
+          }
+          iwork_free(&leaves);
+          iwork_free(&stack);
+          break;
+        }
+
+        /* Calls to fixed builtins skip evaluating the function */
+        ibuiltin f = igen_fixed(g, v->cell[0]);
+        int direct = f && f != builtin_eval && v->count > 1 ? 1 : 0;
+        iwork_push(&w, v);
+        iwork_push(&w, (void*)0);
+        iwork_push(&w, (void*)IGEN_CALL);
+        for (int i = v->count-1; i >= direct; i--) {
+          iwork_push(&w, v->cell[i]);
+          iwork_push(&w, (void*)0);
+          iwork_push(&w, (void*)IGEN_EXPR);
+        }
+      break;
+
+      default:
+        iwork_push(&ids, (void*)(intptr_t)igen_quote(g, v));
+      break;
+    }
+  }
+
+  int result = (int)(intptr_t)iwork_pop(&ids);
+  iwork_free(&w);
+  iwork_free(&ids);
+  return result;
+}
+
+void igen_program(igen* g, ival* prog, FILE* out, char* name) {
+  igen_quoted(g, prog);
+
+  for (int i = 0; i < prog->count; i++) {
+    icbuf_printf(&g->body, "  {\n");
+    int t = igen_expr(g, prog->cell[i]);
+    icbuf_printf(&g->body, "  ival_println(t%i);\n  ival_del(t%i);\n  }\n", t, t);
+  }
+
+  fprintf(out, "/* Generated by igorc from %s */\n", name);
+  fprintf(out, "#include \"parse.h\"\n#include \"vm.h\"\n\n");
+  fprintf(out, "int main(void) {\n  ienv* e = ienv_new();\n  ienv_add_builtins(e);\n");
+  for (int i = 0; i < g->syms->count; i++) {
+    icbuf syms = { NULL, 0, 0 };
+    icbuf_printf(&syms, "  ival* s%i = ival_sym(", i);
+    igen_string(&syms, g->syms->cell[i]->sym);
+    fprintf(out, "%s);\n", syms.s);
+    free(syms.s);
+  }
+  fprintf(out, "\n%s\n", g->body.len ? g->body.s : "");
+  for (int i = 0; i < g->syms->count; i++) { fprintf(out, "  ival_del(s%i);\n", i); }
+  fprintf(out, "  ienv_del(e);\n  return 0;\n}\n");
+}
+
+/* Read a line of any length, without its newline, or NULL at the end of the file */
+char* igen_line(FILE* f) {
+  int len = 0;
+  int cap = 128;
+  char* s = malloc(cap);
+  int c;
+  while ((c = fgetc(f)) != EOF && c != '\n') {
+    if (len + 1 >= cap) { cap *= 2; s = realloc(s, cap); }
+    s[len++] = c;
+  }
+  if (c == EOF && len == 0) {
+    free(s);
+    return NULL;
+  }
+  s[len] = '\0';
+  return s;
+}
+
+int main(int argc, char** argv) {
+  mpc_parser_t* Number   = mpc_new("number");
+  mpc_parser_t* Symbol   = mpc_new("symbol");
+  mpc_parser_t* Sexpr    = mpc_new("sexpr");
+  mpc_parser_t* Qexpr    = mpc_new("qexpr");
+  mpc_parser_t* Expr     = mpc_new("expr");
+  mpc_parser_t* Igor     = mpc_new("igor");
+
+  mpca_lang(MPC_LANG_DEFAULT,
+    "                                                   \
+    number : /-?[0-9]+/ ;                               \
+    symbol : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ;         \
+    sexpr  : '(' <expr>* ')' ;                          \
+    qexpr  : '{' <expr>* '}' ;                          \
+    expr   : <number> | <symbol> | <sexpr> | <qexpr> ;  \
+    igor   : /^/ <expr>* /$/ ; \
+    ",
+    Number, Symbol, Sexpr, Qexpr, Expr, Igor);
+
+  char* input = NULL;
+  char* output = "a.out";
+  int only_c = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) { output = argv[++i]; }
+    else if (strcmp(argv[i], "-S") == 0) { only_c = 1; }
+    else { input = argv[i]; }
+  }
+  if (!input) {
+    fprintf(stderr, "usage: igorc [-S] [-o output] file.ig\n");
+    return 1;
+  }
+
+  FILE* in = fopen(input, "r");
+  if (!in) {
+    perror(input);
+    return 1;
+  }
+
+  /* Each non-blank line is one expression, just as if it were typed into the REPL */
+  ival* prog = ival_qexpr();
+  char* line;
+  while ((line = igen_line(in))) {
+    mpc_result_t r;
+    if (line[strspn(line, " \t\r")] == '\0') { free(line); continue; }
+    ival* deep = ival_read_depth(line);
+    if (deep) {
+      ival_println(deep);
+      return 1;
+    }
+    if (!mpc_parse(input, line, Igor, &r)) {
+      mpc_err_print(r.error);
+      mpc_err_delete(r.error);
+      return 1;
+    }
+    ival_add(prog, ival_read(r.output));
+    mpc_ast_delete(r.output);
+    free(line);
+  }
+  fclose(in);
+
+  /* Write the C next to the output, then hand it to the system compiler */
+  char* source = malloc(strlen(output) + 3);
+  sprintf(source, "%s.c", output);
+  FILE* out = fopen(source, "w");
+  if (!out) {
+    perror(source);
+    return 1;
+  }
+
+  igen g;
+  g.e = ienv_new();
+  ienv_add_builtins(g.e);
+  g.quoted = ival_qexpr();
+  g.syms = ival_qexpr();
+  g.body.s = NULL;
+  g.body.len = 0;
+  g.body.cap = 0;
+  g.temps = 0;
+  g.labels = 0;
+  igen_program(&g, prog, out, input);
+  fclose(out);
+
+  int status = 0;
+  if (!only_c) {
+    char* cmd = malloc(strlen(source) + strlen(output) + 256);
+    sprintf(cmd, "cc -O2 -std=c99 -w -I%s %s %s/libigor.a -lm -pthread -o %s", IGOR_INCLUDE, source, IGOR_LIB, output);
+    status = system(cmd) == 0 ? 0 : 1;
+    if (status == 0) { remove(source); }
+    free(cmd);
+  }
+
+  free(source);
+  free(g.body.s);
+  ival_del(g.quoted);
+  ival_del(g.syms);
+  ienv_del(g.e);
+  ival_del(prog);
+  mpc_cleanup(6, Number, Symbol, Sexpr, Qexpr, Expr, Igor);
+  return status;
+}
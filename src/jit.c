@@ -0,0 +1,342 @@
+/* Native code generation needs mmap, which is outside of plain C99 */
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__) || defined(__FreeBSD__))
+#define IJIT_X64
+#define _DEFAULT_SOURCE
+#include <sys/mman.h>
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
+
+#include <stdlib.h>
+#include "../lib/mpc.h"
+#include "parse.h"
+#include "jit.h"
+#include "par.h"
+
+int ijit_enabled = 1;
+int iarith_enabled = 1;
+
+/* Trees */
+
+iarith* iarith_new(ienv* e) {
+  iarith* a = malloc(sizeof(iarith));
+  a->count = 0;
+  a->code = NULL;
+  a->nfused = 0;
+  a->fused = NULL;
+  a->depth = 0;
+  a->nsyms = 0;
+  a->syms = NULL;
+  a->slots = NULL;
+  a->locals = NULL;
+  a->nops = 0;
+  a->op_slots = NULL;
+  a->op_funs = NULL;
+  a->calls = 0;
+  a->env = e;
+  a->hot = 0;
+  a->native = NULL;
+  a->size = 0;
+  a->failed = 0;
+  return a;
+}
+
+void iarith_del(iarith* a) {
+  #ifdef IJIT_X64
+  if (a->native) { munmap((void*)a->native, a->size); }
+  #endif
+  free(a->syms);
+  free(a->slots);
+  free(a->locals);
+  free(a->op_slots);
+  free(a->op_funs);
+  free(a->code);
+  free(a->fused);
+  free(a);
+}
+
+void iarith_emit(iarith* a, int op, long x) {
+  if (a->count == 0) { a->code = malloc(sizeof(iarith_ins) * 8); }
+  if (a->count >= 8 && (a->count & (a->count - 1)) == 0) {
+    a->code = realloc(a->code, sizeof(iarith_ins) * a->count * 2);
+  }
+  a->count++;
+  a->code[a->count-1].op = op;
+  a->code[a->count-1].x = x;
+}
+
+/* Index of a symbol in the tree, adding it the first time it is seen */
+int iarith_sym(iarith* a, ival* k, int local) {
+  for (int i = 0; i < a->nsyms; i++) {
+    if (strcmp(a->syms[i]->sym, k->sym) == 0) { return i; }
+  }
+  a->nsyms++;
+  a->syms = realloc(a->syms, sizeof(ival*) * a->nsyms);
+  a->slots = realloc(a->slots, sizeof(int) * a->nsyms);
+  a->locals = realloc(a->locals, sizeof(int) * a->nsyms);
+  a->syms[a->nsyms-1] = k;
+  a->slots[a->nsyms-1] = -1;
+  a->locals[a->nsyms-1] = local;
+  return a->nsyms-1;
+}
+
+void iarith_op(iarith* a, int slot, ibuiltin f) {
+  a->calls++;
+  for (int i = 0; i < a->nops; i++) {
+    if (a->op_slots[i] == slot) { return; }
+  }
+  a->nops++;
+  a->op_slots = realloc(a->op_slots, sizeof(int) * a->nops);
+  a->op_funs = realloc(a->op_funs, sizeof(ibuiltin) * a->nops);
+  a->op_slots[a->nops-1] = slot;
+  a->op_funs[a->nops-1] = f;
+}
+
+/* Fusion */
+
+void iarith_fuse(iarith* a) {
+  a->fused = malloc(sizeof(iarith_ins) * (a->count ? a->count : 1));
+  int n = 0, depth = 0;
+
+  for (int i = 0; i < a->count; i++) {
+    iarith_ins ins = a->code[i];
+    int op = ins.op;
+    int binary = op >= IARITH_ADD && op <= IARITH_DIV;
+    if (op == IARITH_NUM || op == IARITH_SYM) { depth++; }
+    if (binary) { depth--; }
+    if (depth > a->depth) { a->depth = depth; }
+
+    /* A number or symbol pushed just to be the right hand side is read in place */
+    if (binary && n && (a->fused[n-1].op == IARITH_NUM || a->fused[n-1].op == IARITH_SYM)) {
+      int base = a->fused[n-1].op == IARITH_NUM ? IARITH_ADD_NUM : IARITH_ADD_SYM;
+      a->fused[n-1].op = base + (op - IARITH_ADD);
+      continue;
+    }
+
+    /* A product just made being added to or taken from what's beneath it */
+    if ((op == IARITH_ADD || op == IARITH_SUB) && n) {
+      int prev = a->fused[n-1].op;
+      int add = op == IARITH_ADD;
+      if (prev == IARITH_MUL)     { a->fused[n-1].op = add ? IARITH_MULADD : IARITH_MULSUB; continue; }
+      if (prev == IARITH_MUL_NUM) { a->fused[n-1].op = add ? IARITH_MULADD_NUM : IARITH_MULSUB_NUM; continue; }
+      if (prev == IARITH_MUL_SYM) { a->fused[n-1].op = add ? IARITH_MULADD_SYM : IARITH_MULSUB_SYM; continue; }
+    }
+
+    a->fused[n++] = ins;
+  }
+  a->nfused = n;
+}
+
+/* Run the fused instructions given the values of the symbols, returning 0 to leave a division to the builtins */
+static int iarith_interp(iarith* a, const long* vals, long* result) {
+  long stack[a->depth + 1];
+  int sp = 0;
+
+  for (int i = 0; i < a->nfused; i++) {
+    iarith_ins ins = a->fused[i];
+    long y = 0;
+
+    /* Right hand sides, from the stack unless fused in */
+    switch (ins.op) {
+      case IARITH_ADD_NUM: case IARITH_SUB_NUM: case IARITH_MUL_NUM: case IARITH_DIV_NUM:
+      case IARITH_MULADD_NUM: case IARITH_MULSUB_NUM:
+        y = ins.x;
+      break;
+      case IARITH_ADD_SYM: case IARITH_SUB_SYM: case IARITH_MUL_SYM: case IARITH_DIV_SYM:
+      case IARITH_MULADD_SYM: case IARITH_MULSUB_SYM:
+        y = vals[ins.x];
+      break;
+      case IARITH_ADD: case IARITH_SUB: case IARITH_MUL: case IARITH_DIV:
+      case IARITH_MULADD: case IARITH_MULSUB:
+        y = stack[--sp];
+      break;
+    }
+
+    switch (ins.op) {
+      case IARITH_NUM: stack[sp++] = ins.x; break;
+      case IARITH_SYM: stack[sp++] = vals[ins.x]; break;
+      case IARITH_NEG: stack[sp-1] = IARITH_WRAP(0, -, stack[sp-1]); break;
+      case IARITH_ADD: case IARITH_ADD_NUM: case IARITH_ADD_SYM:
+        stack[sp-1] = IARITH_WRAP(stack[sp-1], +, y);
+      break;
+      case IARITH_SUB: case IARITH_SUB_NUM: case IARITH_SUB_SYM:
+        stack[sp-1] = IARITH_WRAP(stack[sp-1], -, y);
+      break;
+      case IARITH_MUL: case IARITH_MUL_NUM: case IARITH_MUL_SYM:
+        stack[sp-1] = IARITH_WRAP(stack[sp-1], *, y);
+      break;
+      case IARITH_DIV: case IARITH_DIV_NUM: case IARITH_DIV_SYM:
+        if (y == 0 || y == -1) { return 0; }
+        stack[sp-1] = stack[sp-1] / y;
+      break;
+      case IARITH_MULADD: case IARITH_MULADD_NUM: case IARITH_MULADD_SYM:
+        sp--;
+        stack[sp-1] = IARITH_WRAP(stack[sp-1], +, IARITH_WRAP(stack[sp], *, y));
+      break;
+      case IARITH_MULSUB: case IARITH_MULSUB_NUM: case IARITH_MULSUB_SYM:
+        sp--;
+        stack[sp-1] = IARITH_WRAP(stack[sp-1], -, IARITH_WRAP(stack[sp], *, y));
+      break;
+    }
+  }
+
+  *result = stack[0];
+  return 1;
+}
+
+/* Code Generation */
+
+#ifdef IJIT_X64
+
+typedef struct ijit_buf {
+  unsigned char* code;
+  int count;
+  int* fails;     /* Positions of rel32 jumps to the bail out path */
+  int nfails;
+} ijit_buf;
+
+static void ijit_bytes(ijit_buf* b, const char* bytes, int n) {
+  memcpy(b->code + b->count, bytes, n);
+  b->count += n;
+}
+
+static void ijit_imm(ijit_buf* b, long x, int n) {
+  for (int i = 0; i < n; i++) { b->code[b->count++] = (unsigned char)(x >> (8 * i)); }
+}
+
+/* Jump to the bail out path if the last comparison was equal */
+static void ijit_fail_if_equal(ijit_buf* b) {
+  ijit_bytes(b, "\x0F\x84", 2);
+  b->fails[b->nfails++] = b->count;
+  ijit_imm(b, 0, 4);
+}
+
+/*
+** The tree runs as a stack machine on the hardware stack. rdi holds the
+** symbol values and rsi the ok flag; rbp keeps the frame so bailing out
+** part way through can just drop whatever is left on the stack.
+*/
+static void ijit_compile(iarith* a) {
+
+  /* Every instruction is at most 32 bytes, plus the prologue and both exits */
+  ijit_buf b;
+  b.code = malloc(32 * a->count + 64);
+  b.count = 0;
+  b.fails = malloc(sizeof(int) * (2 * a->count + 1));
+  b.nfails = 0;
+
+  ijit_bytes(&b, "\x55\x48\x89\xE5", 4);             /* push rbp; mov rbp, rsp */
+
+  for (int i = 0; i < a->count; i++) {
+    iarith_ins ins = a->code[i];
+    switch (ins.op) {
+      case IARITH_NUM:
+        ijit_bytes(&b, "\x48\xB8", 2);                 /* mov rax, imm64 */
+        ijit_imm(&b, ins.x, 8);
+        ijit_bytes(&b, "\x50", 1);                     /* push rax */
+      break;
+      case IARITH_SYM:
+        ijit_bytes(&b, "\x48\x8B\x87", 3);             /* mov rax, [rdi + disp32] */
+        ijit_imm(&b, ins.x * 8, 4);
+        ijit_bytes(&b, "\x50", 1);
+      break;
+      case IARITH_NEG:
+        ijit_bytes(&b, "\x58\x48\xF7\xD8\x50", 5);     /* pop rax; neg rax; push rax */
+      break;
+      default:
+        ijit_bytes(&b, "\x59\x58", 2);                 /* pop rcx; pop rax */
+        switch (ins.op) {
+          case IARITH_ADD: ijit_bytes(&b, "\x48\x01\xC8", 3); break;       /* add rax, rcx */
+          case IARITH_SUB: ijit_bytes(&b, "\x48\x29\xC8", 3); break;       /* sub rax, rcx */
+          case IARITH_MUL: ijit_bytes(&b, "\x48\x0F\xAF\xC1", 4); break;   /* imul rax, rcx */
+          case IARITH_DIV:
+            /* Leave division by zero, and the -1 that can trap, to the interpreter */
+            ijit_bytes(&b, "\x48\x85\xC9", 3);                             /* test rcx, rcx */
+            ijit_fail_if_equal(&b);
+            ijit_bytes(&b, "\x48\x83\xF9\xFF", 4);                         /* cmp rcx, -1 */
+            ijit_fail_if_equal(&b);
+            ijit_bytes(&b, "\x48\x99\x48\xF7\xF9", 5);                     /* cqo; idiv rcx */
+          break;
+        }
+        ijit_bytes(&b, "\x50", 1);
+      break;
+    }
+  }
+
+  /* pop rax; mov qword [rsi], 1; leave; ret */
+  ijit_bytes(&b, "\x58\x48\xC7\x06\x01\x00\x00\x00\xC9\xC3", 10);
+
+  /* mov qword [rsi], 0; leave; ret */
+  int fail = b.count;
+  ijit_bytes(&b, "\x48\xC7\x06\x00\x00\x00\x00\xC9\xC3", 9);
+  for (int i = 0; i < b.nfails; i++) {
+    int at = b.fails[i];
+    int rel = fail - (at + 4);
+    memcpy(b.code + at, &rel, 4);
+  }
+
+  /* Copy into executable memory */
+  void* mem = mmap(NULL, b.count, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem != MAP_FAILED) {
+    memcpy(mem, b.code, b.count);
+    /* Another thread may have compiled the same tree meanwhile, the first to finish is kept */
+    ijit_fn none = NULL;
+    if (mprotect(mem, b.count, PROT_READ | PROT_EXEC) == 0 && ILAZY_SET(a->native, none, (ijit_fn)mem)) {
+      a->size = b.count;
+    } else {
+      munmap(mem, b.count);
+    }
+  }
+
+  free(b.code);
+  free(b.fails);
+}
+
+#else
+
+static void ijit_compile(iarith* a) {}
+
+#endif
+
+/* Execution */
+
+int iarith_run(iarith* a, ienv* e, ival** frame, long* result) {
+  if (e != a->env) { return 0; }
+  int hot = ijit_enabled && !a->failed && icount(&a->hot) >= IJIT_HOT;
+  if (!hot && !iarith_enabled) { return 0; }
+
+  /* Operators must not have been redefined */
+  for (int i = 0; i < a->nops; i++) {
+    ival* f = e->vals[a->op_slots[i]];
+    if (f->type != IVAL_FUN || f->fun != a->op_funs[i]) { return 0; }
+  }
+
+  /* Symbols must all be bound to numbers */
+  long vals[a->nsyms ? a->nsyms : 1];
+  for (int i = 0; i < a->nsyms; i++) {
+    ival* v;
+    if (a->locals[i] >= 0) {
+      v = frame[a->locals[i]];
+    } else {
+      int s = ICACHE_GET(a->slots[i]);
+      if (s < 0) {
+        s = ienv_slot(e, a->syms[i]);
+        ICACHE_SET(a->slots[i], s);
+      }
+      if (s < 0) { return 0; }
+      v = e->vals[s];
+    }
+    if (v->type != IVAL_NUM) { return 0; }
+    vals[i] = v->num;
+  }
+
+  if (hot && !ILAZY_GET(a->native)) { ijit_compile(a); }
+  ijit_fn native = hot ? ILAZY_GET(a->native) : NULL;
+  if (hot && !native) { a->failed = 1; }
+  if (!native) { return iarith_interp(a, vals, result); }
+
+  long ok = 0;
+  *result = native(vals, &ok);
+  return ok != 0;
+}
@@ -0,0 +1,88 @@
+#ifndef IGOR_JIT
+#define IGOR_JIT
+
+#include "parse.h"
+
+/* Runs of an arithmetic tree before it is compiled to native code */
+#define IJIT_HOT 64
+
+/* Clear to keep everything in the interpreter */
+extern int ijit_enabled;
+
+/* Clear to leave trees not yet native to the builtins, making a number at every step */
+extern int iarith_enabled;
+
+/* Arithmetic tree instructions, every operator is binary apart from IARITH_NEG */
+enum { IARITH_NUM, IARITH_SYM, IARITH_ADD, IARITH_SUB, IARITH_MUL, IARITH_DIV, IARITH_NEG,
+
+  /*
+  ** Fused ones, which the native code doesn't use. Each operator may take its
+  ** right hand side from a number or a symbol rather than the stack, and a
+  ** multiply with an add or subtract after adds to or subtracts from the
+  ** value beneath its left hand side.
+  */
+  IARITH_ADD_NUM, IARITH_SUB_NUM, IARITH_MUL_NUM, IARITH_DIV_NUM,
+  IARITH_ADD_SYM, IARITH_SUB_SYM, IARITH_MUL_SYM, IARITH_DIV_SYM,
+  IARITH_MULADD, IARITH_MULADD_NUM, IARITH_MULADD_SYM,
+  IARITH_MULSUB, IARITH_MULSUB_NUM, IARITH_MULSUB_SYM };
+
+typedef struct iarith_ins {
+  int op;
+  long x;   /* The number for IARITH_NUM, the symbol index for IARITH_SYM */
+} iarith_ins;
+
+/* Native code takes the values of the symbols and clears *ok to bail out */
+typedef long(*ijit_fn)(const long* vals, long* ok);
+
+typedef struct iarith {
+  /* Postfix program */
+  int count;
+  iarith_ins* code;
+
+  /* The same with instructions fused, for running without native code, and the most it stacks up */
+  int nfused;
+  iarith_ins* fused;
+  int depth;
+
+  /* Symbols read by the tree, borrowed from the chunk's constants, and where they were last found.
+     A symbol naming a lambda's local has its frame slot in locals instead, otherwise -1, and
+     is only borrowed while compiling */
+  int nsyms;
+  ival** syms;
+  int* slots;
+  int* locals;
+
+  /* Operator slots, which must still hold these builtins */
+  int nops;
+  int* op_slots;
+  ibuiltin* op_funs;
+
+  /* Calls to them the tree stands for, each using fuel as the call would */
+  long calls;
+
+  /* Environment the tree was compiled against */
+  ienv* env;
+
+  long hot;
+  ijit_fn native;
+  size_t size;
+  int failed;
+} iarith;
+
+iarith* iarith_new(ienv* e);
+void iarith_del(iarith* a);
+void iarith_emit(iarith* a, int op, long x);
+int iarith_sym(iarith* a, ival* k, int local);
+void iarith_op(iarith* a, int slot, ibuiltin f);
+
+/* Fuse a finished tree's instructions for running without native code */
+void iarith_fuse(iarith* a);
+
+/*
+** Run a tree if its guards hold, natively once hot or else on numbers kept in
+** C, returning 0 to fall back to the builtins. Division by 0 or -1 is always
+** left to them.
+*/
+int iarith_run(iarith* a, ienv* e, ival** frame, long* result);
+
+#endif
@@ -0,0 +1,261 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include "../lib/mpc.h"
+#include "parse.h"
+#include "memo.h"
+#include "par.h"
+
+/* Structural Hashing */
+
+/* FNV-1a over some bytes */
+static unsigned long imemo_mix(unsigned long h, const void* p, size_t n) {
+  const unsigned char* b = p;
+  for (size_t i = 0; i < n; i++) { h = (h ^ b[i]) * 16777619UL; }
+  return h;
+}
+
+/* Equal values hash the same, functions by identity and everything else by contents */
+static unsigned long ival_hash(unsigned long h, ival* v) {
+  iwork w;
+  iwork_init(&w);
+  iwork_push(&w, v);
+
+  while (w.count) {
+    v = iwork_pop(&w);
+    h = imemo_mix(h, &v->type, sizeof(v->type));
+    switch (v->type) {
+      case IVAL_NUM:    h = imemo_mix(h, &v->num, sizeof(v->num)); break;
+      case IVAL_ERR:
+        h = imemo_mix(h, v->err->fmt, strlen(v->err->fmt));
+        h = imemo_mix(h, v->err->args, sizeof(long) * v->err->nargs);
+        h = imemo_mix(h, v->err->text, v->err->length);
+      break;
+      case IVAL_SYM:    h = imemo_mix(h, v->sym, strlen(v->sym)); break;
+      case IVAL_FUN:    h = imemo_mix(h, &v->fun, sizeof(v->fun)); break;
+      case IVAL_LAMBDA: h = imemo_mix(h, &v->lambda, sizeof(v->lambda)); break;
+      case IVAL_MEMO:   h = imemo_mix(h, &v->memo, sizeof(v->memo)); break;
+      case IVAL_SEQ:    h = imemo_mix(h, &v->seq, sizeof(v->seq)); break;
+      case IVAL_FUTURE: h = imemo_mix(h, &v->future, sizeof(v->future)); break;
+      case IVAL_SEXPR:
+      case IVAL_QEXPR:
+        h = imemo_mix(h, &v->count, sizeof(v->count));
+        for (int i = 0; i < v->count; i++) { iwork_push(&w, v->cell[i]); }
+      break;
+    }
+  }
+
+  iwork_free(&w);
+  return h;
+}
+
+/* Errors raised the same way with the same arguments, which have the same message */
+static int ierror_same(ierror* a, ierror* b) {
+  return strcmp(a->fmt, b->fmt) == 0 && a->nargs == b->nargs && a->length == b->length
+      && memcmp(a->args, b->args, sizeof(long) * a->nargs) == 0 && memcmp(a->text, b->text, a->length) == 0;
+}
+
+int ival_same(ival* a, ival* b) {
+  iwork w;
+  iwork_init(&w);
+  iwork_push(&w, a);
+  iwork_push(&w, b);
+
+  int same = 1;
+  while (w.count && same) {
+    b = iwork_pop(&w);
+    a = iwork_pop(&w);
+    if (a->type != b->type) { same = 0; break; }
+    switch (a->type) {
+      case IVAL_NUM:    same = a->num == b->num; break;
+      case IVAL_ERR:    same = ierror_same(a->err, b->err); break;
+      case IVAL_SYM:    same = strcmp(a->sym, b->sym) == 0; break;
+      case IVAL_FUN:    same = a->fun == b->fun; break;
+      case IVAL_LAMBDA: same = a->lambda == b->lambda; break;
+      case IVAL_MEMO:   same = a->memo == b->memo; break;
+      case IVAL_SEQ:    same = a->seq == b->seq; break;
+      case IVAL_FUTURE: same = a->future == b->future; break;
+      case IVAL_SEXPR:
+      case IVAL_QEXPR:
+        same = a->count == b->count;
+        for (int i = 0; same && i < a->count; i++) {
+          iwork_push(&w, a->cell[i]);
+          iwork_push(&w, b->cell[i]);
+        }
+      break;
+    }
+  }
+
+  iwork_free(&w);
+  return same;
+}
+
+static long ival_nodes(ival* v) {
+  iwork w;
+  iwork_init(&w);
+  iwork_push(&w, v);
+
+  long n = 0;
+  while (w.count) {
+    v = iwork_pop(&w);
+    n++;
+    if (v->type == IVAL_SEXPR || v->type == IVAL_QEXPR) {
+      for (int i = 0; i < v->count; i++) { iwork_push(&w, v->cell[i]); }
+    }
+  }
+
+  iwork_free(&w);
+  return n;
+}
+
+/* Memos */
+
+imemo* imemo_new(ival* fn, int max_entries, long max_nodes) {
+  imemo* m = malloc(sizeof(imemo));
+  m->refs = 1;
+  m->lock = 0;
+  m->fn = fn;
+  m->max_entries = max_entries;
+  m->max_nodes = max_nodes;
+  m->count = 0;
+  m->nodes = 0;
+  m->nbuckets = 16;
+  m->buckets = calloc(m->nbuckets, sizeof(imemo_entry*));
+  m->newest = NULL;
+  m->oldest = NULL;
+  m->hits = 0;
+  m->misses = 0;
+  return m;
+}
+
+static void imemo_entry_del(imemo_entry* p) {
+  ival_del(p->key);
+  if (p->result) { ival_del(p->result); }
+  free(p);
+}
+
+void imemo_release(imemo* m) {
+  if (IREF_DEC(m->refs) > 0) { return; }
+  imemo_entry* p = m->newest;
+  while (p) {
+    imemo_entry* older = p->older;
+    imemo_entry_del(p);
+    p = older;
+  }
+  free(m->buckets);
+  ival_del(m->fn);
+  free(m);
+}
+
+/* Use Order */
+
+static void imemo_unlink(imemo* m, imemo_entry* p) {
+  if (p->newer) { p->newer->older = p->older; } else { m->newest = p->older; }
+  if (p->older) { p->older->newer = p->newer; } else { m->oldest = p->newer; }
+}
+
+static void imemo_push(imemo* m, imemo_entry* p) {
+  p->newer = NULL;
+  p->older = m->newest;
+  if (m->newest) { m->newest->newer = p; } else { m->oldest = p; }
+  m->newest = p;
+}
+
+/* Lookup */
+
+static unsigned long imemo_hash(ival** args, int n) {
+  unsigned long h = 2166136261UL;
+  h = imemo_mix(h, &n, sizeof(n));
+  for (int i = 0; i < n; i++) { h = ival_hash(h, args[i]); }
+  return h;
+}
+
+static imemo_entry* imemo_find(imemo* m, unsigned long hash, ival** args, int n) {
+  imemo_entry* p = m->buckets[hash & (m->nbuckets - 1)];
+  for (; p; p = p->next) {
+    if (p->hash != hash || p->key->count != n) { continue; }
+    int same = 1;
+    for (int i = 0; same && i < n; i++) { same = ival_same(p->key->cell[i], args[i]); }
+    if (same) { return p; }
+  }
+  return NULL;
+}
+
+ival* imemo_get(imemo* m, ival** args, int n, imemo_entry** pending) {
+  unsigned long hash = imemo_hash(args, n);
+  ilock_take(&m->lock);
+  imemo_entry* p = imemo_find(m, hash, args, n);
+
+  if (p) {
+    m->hits++;
+    imemo_unlink(m, p);
+    imemo_push(m, p);
+    ival* x = ival_share(p->result);
+    ilock_drop(&m->lock);
+    *pending = NULL;
+    return x;
+  }
+
+  /* The key shares the arguments, which stay unchanged while it holds them. The
+     memo is held on to as well in case the call drops the last copy of it */
+  m->misses++;
+  ilock_drop(&m->lock);
+  p = malloc(sizeof(imemo_entry));
+  p->memo = m;
+  p->hash = hash;
+  p->key = ival_qexpr();
+  for (int i = 0; i < n; i++) { ival_add(p->key, ival_share(args[i])); }
+  p->result = NULL;
+  IREF_INC(m->refs);
+  *pending = p;
+  return NULL;
+}
+
+/* Drop the least recently used entry */
+static void imemo_evict(imemo* m) {
+  imemo_entry* p = m->oldest;
+  imemo_entry** at = &m->buckets[p->hash & (m->nbuckets - 1)];
+  while (*at != p) { at = &(*at)->next; }
+  *at = p->next;
+  imemo_unlink(m, p);
+  m->count--;
+  m->nodes -= p->nodes;
+  imemo_entry_del(p);
+}
+
+static void imemo_grow(imemo* m) {
+  free(m->buckets);
+  m->nbuckets *= 2;
+  m->buckets = calloc(m->nbuckets, sizeof(imemo_entry*));
+  for (imemo_entry* p = m->newest; p; p = p->older) {
+    imemo_entry** at = &m->buckets[p->hash & (m->nbuckets - 1)];
+    p->next = *at;
+    *at = p;
+  }
+}
+
+void imemo_fill(imemo_entry* p, ival* x) {
+  imemo* m = p->memo;
+  p->nodes = ival_nodes(p->key) + ival_nodes(x);
+
+  /* Errors aren't remembered, nor anything too big to ever fit, nor a result another call got in first */
+  ilock_take(&m->lock);
+  if (x->type == IVAL_ERR || p->nodes > m->max_nodes || imemo_find(m, p->hash, p->key->cell, p->key->count)) {
+    ilock_drop(&m->lock);
+    imemo_entry_del(p);
+    imemo_release(m);
+    return;
+  }
+
+  p->result = ival_share(x);
+  if (m->count >= m->nbuckets) { imemo_grow(m); }
+  imemo_entry** at = &m->buckets[p->hash & (m->nbuckets - 1)];
+  p->next = *at;
+  *at = p;
+  imemo_push(m, p);
+  m->count++;
+  m->nodes += p->nodes;
+
+  while (m->count > m->max_entries || m->nodes > m->max_nodes) { imemo_evict(m); }
+  ilock_drop(&m->lock);
+  imemo_release(m);
+}
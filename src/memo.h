@@ -0,0 +1,63 @@
+#ifndef IGOR_MEMO
+#define IGOR_MEMO
+
+#include "parse.h"
+
+/* Limits for a memo made without any */
+#define IMEMO_ENTRIES 1024
+#define IMEMO_NODES   (1 << 18)
+
+typedef struct imemo_entry {
+  struct imemo* memo;
+  unsigned long hash;
+  ival* key;      /* Q-Expression of the arguments */
+  ival* result;   /* NULL until the call it is waiting on returns */
+  long nodes;
+
+  /* Chained in its hash bucket, and in order of use from newest to oldest */
+  struct imemo_entry* next;
+  struct imemo_entry* newer;
+  struct imemo_entry* older;
+} imemo_entry;
+
+typedef struct imemo {
+  int refs;
+
+  /* Held while looking up or filling in entries, see ilock_take */
+  int lock;
+
+  /* The function whose results are cached */
+  ival* fn;
+
+  /* Least recently used entries go first once either limit is passed */
+  int max_entries;
+  long max_nodes;
+  int count;
+  long nodes;
+
+  int nbuckets;
+  imemo_entry** buckets;
+  imemo_entry* newest;
+  imemo_entry* oldest;
+
+  long hits;
+  long misses;
+} imemo;
+
+/* Whether two values are equal as keys, lists by their elements and everything else by identity */
+int ival_same(ival* a, ival* b);
+
+imemo* imemo_new(ival* fn, int max_entries, long max_nodes);
+void imemo_release(imemo* m);
+
+/*
+** Look up the result for "n" arguments, which are left alone. A hit gives the
+** cached result, shared rather than copied. A miss gives NULL and sets *pending
+** to an entry to pass to imemo_fill once the function has run.
+*/
+ival* imemo_get(imemo* m, ival** args, int n, imemo_entry** pending);
+
+/* Cache the result for a pending entry, unless it is an error */
+void imemo_fill(imemo_entry* p, ival* x);
+
+#endif
@@ -0,0 +1,247 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include "../lib/mpc.h"
+#include "parse.h"
+#include "opt.h"
+
+int ibuiltin_pure(ibuiltin f) {
+  return f == builtin_list || f == builtin_head || f == builtin_tail || f == builtin_join
+      || f == builtin_add  || f == builtin_sub  || f == builtin_mul  || f == builtin_div;
+}
+
+int iproven_enabled = 1;
+
+/*
+** Builtins with entries skipping checks, the number of arguments those need
+** or 0 for any, the type each must be, and the type of the result. Some give
+** that type however they are called, as errors aside arithmetic only gives
+** numbers, but others only when their arguments are as needed.
+*/
+static struct { ibuiltin f; ibuiltin unchecked; int count; int arg; int result; int always; } iproven[] = {
+  { builtin_add,  builtin_add_unchecked,  0, IVAL_NUM,   IVAL_NUM,   1 },
+  { builtin_sub,  builtin_sub_unchecked,  0, IVAL_NUM,   IVAL_NUM,   1 },
+  { builtin_mul,  builtin_mul_unchecked,  0, IVAL_NUM,   IVAL_NUM,   1 },
+  { builtin_div,  builtin_div_unchecked,  0, IVAL_NUM,   IVAL_NUM,   1 },
+  { builtin_join, builtin_join_unchecked, 0, IVAL_QEXPR, IVAL_QEXPR, 0 },
+  { builtin_head, builtin_head_unchecked, 1, IVAL_QEXPR, IVAL_QEXPR, 1 },
+  { builtin_tail, builtin_tail_unchecked, 1, IVAL_QEXPR, IVAL_QEXPR, 0 },
+  { builtin_list, builtin_list,           0, -1,         IVAL_QEXPR, 1 },
+};
+
+ibuiltin ibuiltin_unchecked(ibuiltin f, int* types, int n, int* result) {
+  *result = -1;
+  for (int i = 0; i < sizeof(iproven) / sizeof(iproven[0]); i++) {
+    if (iproven[i].f != f) { continue; }
+    int proven = n > 0 && (!iproven[i].count || iproven[i].count == n);
+    for (int j = 0; j < n && proven; j++) { proven = iproven[i].arg < 0 || types[j] == iproven[i].arg; }
+    if (proven || iproven[i].always) { *result = iproven[i].result; }
+    return proven && iproven_enabled ? iproven[i].unchecked : f;
+  }
+  return f;
+}
+
+ibuiltin ienv_builtin(ienv* e, ival* k) {
+  int i = ienv_slot(e, k);
+  if (i < 0 || e->vals[i]->type != IVAL_FUN) { return NULL; }
+  return e->vals[i]->fun;
+}
+
+int iscope_slot(ival* locals, ival* k) {
+  if (!locals) { return -1; }
+  for (int i = 0; i < locals->count; i++) {
+    if (strcmp(locals->cell[i]->sym, k->sym) == 0) { return i; }
+  }
+  return -1;
+}
+
+ibuiltin iscope_builtin(ienv* e, ival* locals, ival* k) {
+  return iscope_slot(locals, k) < 0 ? ienv_builtin(e, k) : NULL;
+}
+
+static struct { ibuiltin f; char* name; } iforms[] = {
+  { builtin_if, "if" }, { builtin_and, "and" }, { builtin_or, "or" },
+};
+
+ibuiltin iscope_form(ienv* e, ival* locals, ival* k) {
+  ibuiltin f = iscope_builtin(e, locals, k);
+  for (int i = 0; f && i < sizeof(iforms) / sizeof(iforms[0]); i++) {
+    if (iforms[i].f == f && strcmp(iforms[i].name, k->sym) == 0) { return f; }
+  }
+  return NULL;
+}
+
+/* Pipelines */
+
+int ifuse_enabled = 1;
+
+/* Arguments before the list of a call that can join a pipeline, or 0. Inner calls can only map or filter */
+static int ipipe_args(ienv* e, ival* locals, ival* v, int inner) {
+  if (v->type != IVAL_SEXPR || v->count < 3 || v->cell[0]->type != IVAL_SYM) { return 0; }
+  ibuiltin f = iscope_builtin(e, locals, v->cell[0]);
+  if ((f == builtin_map || f == builtin_filter) && v->count == 3) { return 1; }
+  if (inner) { return 0; }
+  if (f == builtin_reduce && v->count == 3) { return 1; }
+  if (f == builtin_fold && v->count == 4) { return 2; }
+  return 0;
+}
+
+ival* ival_fuse(ienv* e, ival* locals, ival* v) {
+  int k = ifuse_enabled ? ipipe_args(e, locals, v, 0) : 0;
+  if (!k || !ipipe_args(e, locals, v->cell[v->count-1], 1)) { return v; }
+
+  /* Every call gives up its function and arguments in order, so they are still evaluated as written */
+  ival* x = ival_add(ival_sexpr(), ival_fun(builtin_pipe));
+  ival_add(x, ival_num(k));
+  while (ipipe_args(e, locals, v, x->count > 2)) {
+    ival* list = ival_pop(v, v->count-1);
+    while (v->count) { ival_add(x, ival_pop(v, 0)); }
+    ival_del(v);
+    v = list;
+  }
+  return ival_add(x, v);
+}
+
+/* Values which evaluate to themselves */
+static int ival_constant(ival* v) {
+  return v->type == IVAL_NUM || v->type == IVAL_QEXPR;
+}
+
+/* Replace an S-Expression whose children are already folded with its value, if it has one */
+static ival* ival_fold_sexpr(ienv* e, ival* locals, ival* v) {
+
+  /* (x) is just x */
+  if (v->count == 1 && ival_constant(v->cell[0])) { return ival_take(v, 0); }
+  if (v->count < 2 || v->cell[0]->type != IVAL_SYM) { return v; }
+
+  ibuiltin f = iscope_builtin(e, locals, v->cell[0]);
+  if (!f || !ibuiltin_pure(f)) { return v; }
+  for (int i = 1; i < v->count; i++) {
+    if (!ival_constant(v->cell[i])) { return v; }
+  }
+
+  /* Dividing by -1 can overflow, so is left to the checks made at run time rather than tried while compiling */
+  for (int i = 2; f == builtin_div && i < v->count; i++) {
+    if (v->cell[i]->type == IVAL_NUM && v->cell[i]->num == -1) { return v; }
+  }
+
+  /* Run the builtin on the arguments shared rather than copied, as lists folded already can be as deep as the expression */
+  ival* a = ival_sexpr();
+  for (int i = 1; i < v->count; i++) { ival_add(a, ival_share(v->cell[i])); }
+  ival* x = f(e, a);
+
+  /* Errors are left to happen at run time, exactly as they would have */
+  if (!ival_constant(x)) {
+    ival_del(x);
+    return v;
+  }
+
+  ival_del(v);
+  return x;
+}
+
+/* Does anything in v, quoted or not, refer to the builtin f */
+static int ival_mentions(ienv* e, ival* locals, ival* v, ibuiltin f) {
+  iwork w;
+  iwork_init(&w);
+  iwork_push(&w, v);
+
+  int found = 0;
+  while (w.count && !found) {
+    v = iwork_pop(&w);
+    if (v->type == IVAL_SYM) { found = iscope_builtin(e, locals, v) == f; }
+    if (v->type == IVAL_SEXPR || v->type == IVAL_QEXPR) {
+      for (int i = 0; i < v->count; i++) { iwork_push(&w, v->cell[i]); }
+    }
+  }
+
+  iwork_free(&w);
+  return found;
+}
+
+/* Does v call anything but pure builtins, which could then redefine what the rest of it calls, directly or through a lambda */
+static int ival_impure(ienv* e, ival* locals, ival* v) {
+  iwork w;
+  iwork_init(&w);
+  iwork_push(&w, v);
+
+  /* Q-Expressions only run when passed to something impure, such as eval or if */
+  int found = 0;
+  while (w.count && !found) {
+    v = iwork_pop(&w);
+    if (v->type != IVAL_SEXPR) { continue; }
+    if (v->count && v->cell[0]->type == IVAL_SYM) {
+      ibuiltin f = iscope_builtin(e, locals, v->cell[0]);
+      found = !f || !ibuiltin_pure(f);
+    }
+    for (int i = 0; i < v->count; i++) { iwork_push(&w, v->cell[i]); }
+  }
+
+  iwork_free(&w);
+  return found;
+}
+
+ival* ival_fold(ienv* e, ival* locals, ival* v) {
+
+  /* Code that may redefine things can't trust what they are bound to now */
+  if (ival_impure(e, locals, v)) { return v; }
+  v = ival_unshare(v);
+
+  /* Pairs of (slot holding an S-Expression, children done), folded bottom up */
+  iwork w;
+  iwork_init(&w);
+  iwork_push(&w, &v);
+  iwork_push(&w, (void*)0);
+
+  while (w.count) {
+    int done = (int)(intptr_t)iwork_pop(&w);
+    ival** slot = iwork_pop(&w);
+    ival* x = *slot;
+    if (x->type != IVAL_SEXPR) { continue; }
+
+    if (done) {
+      *slot = ival_fold_sexpr(e, locals, x);
+      continue;
+    }
+
+    /* Q-Expressions are data, only S-Expression children are folded */
+    iwork_push(&w, slot);
+    iwork_push(&w, (void*)1);
+    for (int i = 0; i < x->count; i++) {
+      if (x->cell[i]->type != IVAL_SEXPR) { continue; }
+      iwork_push(&w, &x->cell[i]);
+      iwork_push(&w, (void*)0);
+    }
+  }
+
+  iwork_free(&w);
+  return v;
+}
+
+/* Parallelism */
+
+/* Nodes an expression must come to before being worth another thread, with each call to something unknown counting for this many */
+#define IPAR_COST 256
+
+int ival_heavy(ienv* e, ival* locals, ival* v) {
+  if (v->type != IVAL_SEXPR || ival_mentions(e, locals, v, builtin_def)) { return 0; }
+
+  /* Only what is evaluated counts, a Q-Expression being a single value */
+  iwork w;
+  iwork_init(&w);
+  iwork_push(&w, v);
+
+  long cost = 0;
+  while (w.count && cost < IPAR_COST) {
+    v = iwork_pop(&w);
+    cost++;
+    if (v->type != IVAL_SEXPR || v->count == 0) { continue; }
+
+    ival* f = v->cell[0];
+    ibuiltin b = f->type == IVAL_SYM ? iscope_builtin(e, locals, f) : NULL;
+    if (!b || !(ibuiltin_pure(b) || b == builtin_lambda || iscope_form(e, locals, f))) { cost += IPAR_COST; }
+    for (int i = 0; i < v->count; i++) { iwork_push(&w, v->cell[i]); }
+  }
+
+  iwork_free(&w);
+  return cost >= IPAR_COST;
+}
@@ -0,0 +1,49 @@
+#ifndef IGOR_OPT
+#define IGOR_OPT
+
+#include "parse.h"
+
+/* Builtins with no side effects, which are safe to run early */
+int ibuiltin_pure(ibuiltin f);
+
+/* Clear to call builtins through their checked entries however sure the compiler is of their arguments */
+extern int iproven_enabled;
+
+/*
+** The entry to call a builtin by, given what each of its n arguments is
+** proven to be, or -1 where that isn't known. The checks an entry skips are
+** only the ones its arguments can't fail. Sets what the result is proven to
+** be. Errors never reach a builtin, so a value proven to be of a type may
+** still be an error.
+*/
+ibuiltin ibuiltin_unchecked(ibuiltin f, int* types, int n, int* result);
+
+/* The builtin a symbol is currently bound to, or NULL */
+ibuiltin ienv_builtin(ienv* e, ival* k);
+
+/* Position of a symbol among a lambda's locals, or -1. Top level code has NULL locals */
+int iscope_slot(ival* locals, ival* k);
+
+/* The builtin a symbol refers to where locals shadow the environment, or NULL */
+ibuiltin iscope_builtin(ienv* e, ival* locals, ival* k);
+
+/*
+** The special form a symbol names, or NULL. These are builtins the compiler
+** turns into control flow, but only when called by their own names, which
+** can't be redefined.
+*/
+ibuiltin iscope_form(ienv* e, ival* locals, ival* k);
+
+/* Clear to run chains of maps and filters a call at a time */
+extern int ifuse_enabled;
+
+/* Rewrite a call to map, filter, fold or reduce on the result of a map or filter as one call to builtin_pipe */
+ival* ival_fuse(ienv* e, ival* locals, ival* v);
+
+/* Whether evaluating an expression may take long enough to be worth doing on another thread */
+int ival_heavy(ienv* e, ival* locals, ival* v);
+
+/* Fold constant sub-expressions of a read expression, taking ownership of it */
+ival* ival_fold(ienv* e, ival* locals, ival* v);
+
+#endif
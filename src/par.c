@@ -0,0 +1,396 @@
+/* Threads are outside of plain C99 */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdint.h>
+#include "../lib/mpc.h"
+#include "parse.h"
+#include "vm.h"
+#include "par.h"
+
+int ipool_threads = 1;
+
+/* How many tasks this thread is in the middle of, one inside another */
+static ITHREAD int ipool_depth;
+
+/* Run a task here and now, with nobody else to claim it */
+static void ipool_now(itask* t) {
+  t->state = ITASK_RUNNING;
+  ipool_depth++;
+  t->run(t);
+  ipool_depth--;
+  t->state = ITASK_DONE;
+  if (t->drop) { t->drop(t); }
+}
+
+#ifdef IPAR_THREADS
+
+#include <pthread.h>
+#include <sched.h>
+
+/* Times a thread out of work looks again before going to sleep */
+#define IPOOL_SPINS 64
+
+/* How deeply tasks may nest on one thread's own stack before waiting stops running others */
+#define IPOOL_DEPTH 32
+
+/*
+** Each thread pushes and takes tasks at the bottom of its own deque, while
+** threads out of work steal the oldest from the top of another's. Only a
+** steal of the last task left races with its owner, settled by whichever
+** moves the top first (Chase and Lev, as given by Le et al. for C11 atomics).
+*/
+typedef struct iring {
+  long mask;
+
+  /* The ring this one replaced, kept until the pool stops as thieves may still be reading it */
+  struct iring* older;
+
+  itask* items[];
+} iring;
+
+typedef struct ideque {
+  long top;
+  long bottom;
+  iring* ring;
+} ideque;
+
+static ideque* ipool_deques;
+static pthread_t* ipool_handles;
+
+/* Which deque is this thread's, the one that started the pool having the first */
+static ITHREAD int ipool_self;
+
+/* Tasks sitting in deques, threads not running one, and of those the ones asleep */
+static int ipool_queued;
+static int ipool_idlers;
+static int ipool_sleepers;
+
+/* Tasks given to the pool yet to finish */
+static int ipool_pending;
+
+static int ipool_stopping;
+static pthread_mutex_t ipool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ipool_wake = PTHREAD_COND_INITIALIZER;
+
+/* Deques */
+
+static iring* iring_new(long size, iring* older) {
+  iring* r = malloc(sizeof(iring) + sizeof(itask*) * size);
+  r->mask = size - 1;
+  r->older = older;
+  return r;
+}
+
+/* Only the owner pushes, so only the owner ever grows the ring */
+static void ideque_push(ideque* d, itask* t) {
+  long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+  long top = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+  iring* r = __atomic_load_n(&d->ring, __ATOMIC_RELAXED);
+
+  if (b - top > r->mask) {
+    iring* x = iring_new((r->mask + 1) * 2, r);
+    for (long i = top; i < b; i++) {
+      x->items[i & x->mask] = __atomic_load_n(&r->items[i & r->mask], __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&d->ring, x, __ATOMIC_RELEASE);
+    r = x;
+  }
+
+  __atomic_store_n(&r->items[b & r->mask], t, __ATOMIC_RELAXED);
+  __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELEASE);
+  __atomic_add_fetch(&ipool_queued, 1, __ATOMIC_SEQ_CST);
+}
+
+static itask* ideque_take(ideque* d) {
+  long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+  iring* r = __atomic_load_n(&d->ring, __ATOMIC_RELAXED);
+  __atomic_store_n(&d->bottom, b, __ATOMIC_SEQ_CST);
+  long top = __atomic_load_n(&d->top, __ATOMIC_SEQ_CST);
+
+  if (top > b) {
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    return NULL;
+  }
+
+  itask* t = __atomic_load_n(&r->items[b & r->mask], __ATOMIC_RELAXED);
+  if (top == b) {
+    if (!__atomic_compare_exchange_n(&d->top, &top, top + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) { t = NULL; }
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+  }
+  if (t) { __atomic_sub_fetch(&ipool_queued, 1, __ATOMIC_SEQ_CST); }
+  return t;
+}
+
+/* NULL when there is nothing to steal, or another thread got to it first */
+static itask* ideque_steal(ideque* d) {
+  long top = __atomic_load_n(&d->top, __ATOMIC_SEQ_CST);
+  long b = __atomic_load_n(&d->bottom, __ATOMIC_SEQ_CST);
+  if (top >= b) { return NULL; }
+
+  iring* r = __atomic_load_n(&d->ring, __ATOMIC_ACQUIRE);
+  itask* t = __atomic_load_n(&r->items[top & r->mask], __ATOMIC_RELAXED);
+  if (!__atomic_compare_exchange_n(&d->top, &top, top + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) { return NULL; }
+  __atomic_sub_fetch(&ipool_queued, 1, __ATOMIC_SEQ_CST);
+  return t;
+}
+
+/* Tasks */
+
+/* Run a task if nobody else has claimed it, returning whether this thread did */
+static int ipool_claim(itask* t) {
+  int none = ITASK_WAITING;
+  if (!__atomic_compare_exchange_n(&t->state, &none, ITASK_RUNNING, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) { return 0; }
+  ipool_depth++;
+  t->run(t);
+  ipool_depth--;
+
+  /* The task may be gone as soon as it is seen to be done */
+  __atomic_store_n(&t->state, ITASK_DONE, __ATOMIC_RELEASE);
+  __atomic_sub_fetch(&ipool_pending, 1, __ATOMIC_SEQ_CST);
+  return 1;
+}
+
+/* Run a task taken out of a deque, unless it was claimed already, and then let go of it */
+static void ipool_exec(itask* t) {
+  void (*drop)(itask*) = t->drop;
+  ipool_claim(t);
+  if (drop) { drop(t); }
+}
+
+/* Threads */
+
+/* The newest task of this thread's own, or else the oldest of someone else's */
+static itask* ipool_find(void) {
+  itask* t = ideque_take(&ipool_deques[ipool_self]);
+  for (int i = 1; !t && i < ipool_threads; i++) {
+    t = ideque_steal(&ipool_deques[(ipool_self + i) % ipool_threads]);
+  }
+  return t;
+}
+
+/*
+** Run something else while waiting on a task, or give way to threads that can.
+** Too deep already, only the task waited on is run, if nobody has started it,
+** so that the thread still gets to it but helping doesn't nest without end.
+*/
+static void ipool_help(itask* waiting) {
+  if (ipool_depth >= IPOOL_DEPTH) {
+    if (!waiting || !ipool_claim(waiting)) { sched_yield(); }
+    return;
+  }
+  itask* t = ipool_find();
+  if (t) { ipool_exec(t); } else { sched_yield(); }
+}
+
+static void ipool_wake_all(void) {
+  if (!__atomic_load_n(&ipool_sleepers, __ATOMIC_SEQ_CST)) { return; }
+  pthread_mutex_lock(&ipool_lock);
+  pthread_cond_broadcast(&ipool_wake);
+  pthread_mutex_unlock(&ipool_lock);
+}
+
+static void ipool_sleep(void) {
+  for (int i = 0; i < IPOOL_SPINS; i++) {
+    if (__atomic_load_n(&ipool_queued, __ATOMIC_SEQ_CST)) { return; }
+    sched_yield();
+  }
+
+  /* Anyone queueing a task after this checks for sleepers, and so wakes us */
+  pthread_mutex_lock(&ipool_lock);
+  __atomic_add_fetch(&ipool_sleepers, 1, __ATOMIC_SEQ_CST);
+  while (!__atomic_load_n(&ipool_queued, __ATOMIC_SEQ_CST) && !ipool_stopping) {
+    pthread_cond_wait(&ipool_wake, &ipool_lock);
+  }
+  __atomic_sub_fetch(&ipool_sleepers, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&ipool_lock);
+}
+
+static void* ipool_worker(void* self) {
+  ipool_self = (int)(intptr_t)self;
+  while (!__atomic_load_n(&ipool_stopping, __ATOMIC_ACQUIRE)) {
+    itask* t = ipool_find();
+    if (!t) { ipool_sleep(); continue; }
+    __atomic_sub_fetch(&ipool_idlers, 1, __ATOMIC_SEQ_CST);
+    ipool_exec(t);
+    __atomic_add_fetch(&ipool_idlers, 1, __ATOMIC_SEQ_CST);
+  }
+  ival_spares_free();
+  return NULL;
+}
+
+/* Pool */
+
+int ipool_start(int n) {
+  if (n <= 1 || ipool_threads > 1) { return ipool_threads > 1; }
+
+  ipool_deques = calloc(n, sizeof(ideque));
+  for (int i = 0; i < n; i++) { ipool_deques[i].ring = iring_new(64, NULL); }
+  ipool_handles = malloc(sizeof(pthread_t) * n);
+  ipool_self = 0;
+  ipool_idlers = n - 1;
+
+  /* Values are shared from here on */
+  ival_threaded = 1;
+  ipool_threads = n;
+  for (int i = 1; i < n; i++) {
+    if (pthread_create(&ipool_handles[i], NULL, ipool_worker, (void*)(intptr_t)i) != 0) {
+      ipool_threads = i;
+      ipool_stop();
+      return 0;
+    }
+  }
+  return 1;
+}
+
+void ipool_stop(void) {
+  if (ipool_threads == 1) { return; }
+  ipool_quiet();
+
+  pthread_mutex_lock(&ipool_lock);
+  __atomic_store_n(&ipool_stopping, 1, __ATOMIC_RELEASE);
+  pthread_cond_broadcast(&ipool_wake);
+  pthread_mutex_unlock(&ipool_lock);
+  for (int i = 1; i < ipool_threads; i++) { pthread_join(ipool_handles[i], NULL); }
+
+  /* Anything left was claimed by a join, but the deque still held on to it */
+  for (int i = 0; i < ipool_threads; i++) {
+    ideque* d = &ipool_deques[i];
+    for (long j = d->top; j < d->bottom; j++) { ipool_exec(d->ring->items[j & d->ring->mask]); }
+    while (d->ring) {
+      iring* older = d->ring->older;
+      free(d->ring);
+      d->ring = older;
+    }
+  }
+  free(ipool_deques);
+  free(ipool_handles);
+  ipool_queued = 0;
+  ipool_stopping = 0;
+  ipool_threads = 1;
+  ival_threaded = 0;
+}
+
+int ipool_idle(void) {
+  return ipool_threads > 1
+    && __atomic_load_n(&ipool_idlers, __ATOMIC_RELAXED) > __atomic_load_n(&ipool_queued, __ATOMIC_RELAXED);
+}
+
+int ipool_busy(void) {
+  return ipool_depth > 0;
+}
+
+void ipool_quiet(void) {
+  while (ipool_threads > 1 && __atomic_load_n(&ipool_pending, __ATOMIC_SEQ_CST)) { ipool_help(NULL); }
+}
+
+void ipool_run(itask** tasks, int n) {
+  for (int i = 0; i < n; i++) {
+    tasks[i]->state = ITASK_WAITING;
+    tasks[i]->drop = NULL;
+  }
+  __atomic_add_fetch(&ipool_pending, n, __ATOMIC_SEQ_CST);
+
+  /* Pushed last first, so this thread gets back to them in order if nobody steals them */
+  ideque* d = &ipool_deques[ipool_self];
+  for (int i = n-1; i >= 1; i--) { ideque_push(d, tasks[i]); }
+  ipool_wake_all();
+
+  ipool_claim(tasks[0]);
+  for (int i = 1; i < n; i++) {
+    while (__atomic_load_n(&tasks[i]->state, __ATOMIC_ACQUIRE) != ITASK_DONE) { ipool_help(tasks[i]); }
+  }
+}
+
+void ipool_spawn(itask* t) {
+  if (ipool_threads == 1) {
+    ipool_now(t);
+    return;
+  }
+
+  t->state = ITASK_WAITING;
+
+  __atomic_add_fetch(&ipool_pending, 1, __ATOMIC_SEQ_CST);
+  ideque_push(&ipool_deques[ipool_self], t);
+  ipool_wake_all();
+}
+
+void ipool_join(itask* t) {
+  if (ipool_threads == 1 || ipool_claim(t)) { return; }
+  while (__atomic_load_n(&t->state, __ATOMIC_ACQUIRE) != ITASK_DONE) { ipool_help(t); }
+}
+
+void ilock_take(int* l) {
+  if (ipool_threads == 1) { return; }
+  while (__atomic_exchange_n(l, 1, __ATOMIC_ACQUIRE)) { sched_yield(); }
+}
+
+void ilock_drop(int* l) {
+  if (ipool_threads == 1) { return; }
+  __atomic_store_n(l, 0, __ATOMIC_RELEASE);
+}
+
+#else
+
+int ipool_start(int n) { return 0; }
+void ipool_stop(void) {}
+int ipool_idle(void) { return 0; }
+int ipool_busy(void) { return ipool_depth > 0; }
+void ipool_quiet(void) {}
+
+void ipool_run(itask** tasks, int n) {
+  for (int i = 0; i < n; i++) {
+    tasks[i]->drop = NULL;
+    ipool_now(tasks[i]);
+  }
+}
+
+void ipool_spawn(itask* t) { ipool_now(t); }
+void ipool_join(itask* t) {}
+
+void ilock_take(int* l) {}
+void ilock_drop(int* l) {}
+
+#endif
+
+/* Futures */
+
+static void ifuture_run(itask* t) {
+  ifuture* f = (ifuture*)t;
+  ival* call = f->call;
+  f->value = ivm_call(f->e, call->cell, call->count);
+  f->call = NULL;
+  free(call->cell);
+  ival_free(call);
+}
+
+/* The deque's hold on a future, let go once it is taken out */
+static void ifuture_drop(itask* t) {
+  ifuture_release((ifuture*)t);
+}
+
+ifuture* ifuture_new(ienv* e, ival* call) {
+  ifuture* f = malloc(sizeof(ifuture));
+  f->task.run = ifuture_run;
+  f->task.drop = ifuture_drop;
+  f->refs = 2;
+  f->e = e;
+  f->call = call;
+  f->value = NULL;
+
+  /* Evaluation pinned to this thread keeps its work here, where it is counted */
+  if (ivm_pinned()) { ipool_now(&f->task); } else { ipool_spawn(&f->task); }
+  return f;
+}
+
+void ifuture_release(ifuture* f) {
+  if (IREF_DEC(f->refs) > 0) { return; }
+  if (f->call) { ival_del(f->call); }
+  if (f->value) { ival_del(f->value); }
+  free(f);
+}
+
+ival* ifuture_await(ifuture* f) {
+  ipool_join(&f->task);
+  return ival_share(f->value);
+}
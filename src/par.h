@@ -0,0 +1,118 @@
+#ifndef IGOR_PAR
+#define IGOR_PAR
+
+#include "parse.h"
+
+/* Parallel evaluation needs threads and atomics, from POSIX and GCC or Clang */
+#if defined(__GNUC__) && defined(__unix__) && !defined(IGOR_NO_THREADS)
+#define IPAR_THREADS
+#endif
+
+/* Storage each thread has its own of */
+#ifdef IPAR_THREADS
+#define ITHREAD __thread
+#else
+#define ITHREAD
+#endif
+
+/* A piece of work for the pool, embedded at the start of whatever it works on */
+typedef struct itask {
+  void (*run)(struct itask* t);
+
+  /* Called by whoever takes it out of a deque once done with it, or NULL */
+  void (*drop)(struct itask* t);
+
+  int state;
+} itask;
+
+/* Tasks only run once, by whichever thread claims them first */
+enum { ITASK_WAITING, ITASK_RUNNING, ITASK_DONE };
+
+/* Threads evaluating, counting the one that started them, or 1 when not running in parallel */
+extern int ipool_threads;
+
+/* Start "n" threads in all, returning 0 if they can't be */
+int ipool_start(int n);
+
+/* Stop the threads once every task has run */
+void ipool_stop(void);
+
+/* Whether some thread is waiting for work, so that making tasks is worthwhile */
+int ipool_idle(void);
+
+/* Whether this thread is running a task, during which the environment can't change */
+int ipool_busy(void);
+
+/* Wait for every task to finish, running them meanwhile, so the environment can change */
+void ipool_quiet(void);
+
+/*
+** Run "n" tasks, which belong to the caller, the first on this thread and the
+** rest wherever there is a thread free to take them. While waiting, this thread
+** runs other tasks.
+*/
+void ipool_run(itask** tasks, int n);
+
+/* Queue a task to run when a thread is free, or run it now with no threads to run it */
+void ipool_spawn(itask* t);
+
+/* Wait for a task queued by ipool_spawn, running it here if nobody has started it */
+void ipool_join(itask* t);
+
+/* Futures */
+
+/* The result of a call made on the pool, shared by every copy */
+typedef struct ifuture {
+  itask task;
+  int refs;
+  ienv* e;
+
+  /* The function and its arguments until run, and after that the result */
+  ival* call;
+  ival* value;
+} ifuture;
+
+/* Start applying an S-Expression of a function and its arguments, taking ownership of it */
+ifuture* ifuture_new(ienv* e, ival* call);
+void ifuture_release(ifuture* f);
+
+/* The result once there is one, shared */
+ival* ifuture_await(ifuture* f);
+
+/*
+** Pointers filled in on first use, which another thread may be filling in at
+** the same time. ILAZY_SET gives 0 if it lost, with none set to the winner's.
+*/
+#ifdef __GNUC__
+#define ILAZY_GET(p) __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define ILAZY_SET(p, none, x) __atomic_compare_exchange_n(&(p), &(none), (x), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#else
+#define ILAZY_GET(p) (p)
+#define ILAZY_SET(p, none, x) ((p) = (x), 1)
+#endif
+
+/* Caches which threads may fill in at once, each with the same value */
+#ifdef __GNUC__
+#define ICACHE_GET(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define ICACHE_SET(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+#else
+#define ICACHE_GET(x) (x)
+#define ICACHE_SET(x, v) ((x) = (v))
+#endif
+
+/* Count up without a locked instruction, threads counting at once losing the odd count */
+static inline long icount(long* x) {
+  #ifdef __GNUC__
+  long n = __atomic_load_n(x, __ATOMIC_RELAXED) + 1;
+  __atomic_store_n(x, n, __ATOMIC_RELAXED);
+  return n;
+  #else
+  return ++*x;
+  #endif
+}
+
+/* A lock for short stretches of work, only needing taking while the pool runs */
+void ilock_take(int* l);
+void ilock_drop(int* l);
+
+#endif
@@ -1,39 +1,144 @@
 #include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
 #include "../lib/mpc.h"
 #include "parse.h"
+#include "vm.h"
+#include "memo.h"
+#include "seq.h"
+#include "opt.h"
+#include "par.h"
+#include "react.h"
+
+/* Allocation */
+
+/* Values freed by each thread and kept for it to reuse, chained through their cells. None under ASan, to let it see them */
+#ifdef __SANITIZE_ADDRESS__
+#define IVAL_SPARES 0
+#else
+#define IVAL_SPARES 4096
+#endif
+
+int ival_threaded = 0;
+
+static ITHREAD ival* ival_spares;
+static ITHREAD int ival_nspares;
+
+ival* ival_alloc(void) {
+  ival* v = ival_spares;
+  if (!v) { return malloc(sizeof(ival)); }
+  ival_spares = (ival*)v->cell;
+  ival_nspares--;
+  return v;
+}
+
+void ival_free(ival* v) {
+  if (ival_nspares == IVAL_SPARES) {
+    free(v);
+    return;
+  }
+  v->cell = (ival**)ival_spares;
+  ival_spares = v;
+  ival_nspares++;
+}
+
+void ival_spares_free(void) {
+  while (ival_spares) {
+    ival* v = ival_spares;
+    ival_spares = (ival*)v->cell;
+    free(v);
+  }
+  ival_nspares = 0;
+}
+
+/* Construction */
 
 ival* ival_num(long x) {
-  ival* v = malloc(sizeof(ival));
+  ival* v = ival_alloc();
   v->type = IVAL_NUM;
   v->num = x;
   return v;
 }
 
+/* Step past one conversion of a format, noting what it takes, or none for a "%%" */
+static char* ierror_spec(char* p, char* kind) {
+  p++;
+  while (*p && strchr("-+ #0123456789.", *p)) { p++; }
+  *kind = 'i';
+  while (*p == 'l') { *kind = 'l'; p++; }
+  if (*p == 's') { *kind = 's'; }
+  if (*p == '%') { *kind = 0; }
+  return *p ? p + 1 : p;
+}
+
 ival* ival_err(char* fmt, ...) {
-  ival* v = malloc(sizeof(ival));
-  v->type = IVAL_ERR;
-  
-  /* Create a va list and initialize it */
+  char kinds[IERROR_ARGS];
+  long nums[IERROR_ARGS];
+  char* strs[IERROR_ARGS];
+  int n = 0, length = 0;
+
+  /* Take the arguments as the format says, leaving them as they are */
   va_list va;
   va_start(va, fmt);
-  
-  /* Allocate 512 bytes of space */
-  v->err = malloc(512);
-  
-  /* printf into the error string with a maximum of 511 characters */
-  vsnprintf(v->err, 511, fmt, va);
-  
-  /* Reallocate to number of bytes actually used */
-  v->err = realloc(v->err, strlen(v->err)+1);
-  
-  /* Cleanup our va list */
+  for (char* p = strchr(fmt, '%'); p && n < IERROR_ARGS; p = strchr(p, '%')) {
+    p = ierror_spec(p, &kinds[n]);
+    switch (kinds[n]) {
+      case 0: continue;
+      case 's': strs[n] = va_arg(va, char*); length += strlen(strs[n]) + 1; break;
+      case 'l': nums[n] = va_arg(va, long); break;
+      default: nums[n] = va_arg(va, int); break;
+    }
+    n++;
+  }
   va_end(va);
-  
+
+  /* Strings could be gone by the time it is printed, so they are kept in the error itself */
+  ierror* x = malloc(sizeof(ierror) + length);
+  x->fmt = fmt;
+  x->nargs = n;
+  x->length = length;
+  int at = 0;
+  for (int i = 0; i < n; i++) {
+    x->kinds[i] = kinds[i];
+    if (kinds[i] != 's') {
+      x->args[i] = nums[i];
+      continue;
+    }
+    x->args[i] = at;
+    strcpy(x->text + at, strs[i]);
+    at += strlen(strs[i]) + 1;
+  }
+
+  ival* v = ival_alloc();
+  v->type = IVAL_ERR;
+  v->err = x;
   return v;
 }
 
+/* Print an error's message, a conversion at a time */
+static void ierror_print(ierror* x) {
+  char spec[32];
+  char* p = x->fmt;
+  int i = 0;
+  for (char* q = strchr(p, '%'); q; q = strchr(p, '%')) {
+    printf("%.*s", (int)(q - p), p);
+    char kind;
+    p = ierror_spec(q, &kind);
+    snprintf(spec, sizeof(spec), "%.*s", (int)(p - q), q);
+    if (!kind) { putchar('%'); continue; }
+    if (i >= x->nargs) { break; }
+    switch (kind) {
+      case 's': printf(spec, x->text + x->args[i]); break;
+      case 'l': printf(spec, x->args[i]); break;
+      default: printf(spec, (int)x->args[i]); break;
+    }
+    i++;
+  }
+  printf("%s", p);
+}
+
 ival* ival_sym(char* s) {
-  ival* v = malloc(sizeof(ival));
+  ival* v = ival_alloc();
   v->type = IVAL_SYM;
   v->sym = malloc(strlen(s) + 1);
   strcpy(v->sym, s);
@@ -41,50 +146,164 @@ ival* ival_sym(char* s) {
 }
 
 ival* ival_fun(ibuiltin func) {
-  ival* v = malloc(sizeof(ival));
+  ival* v = ival_alloc();
   v->type = IVAL_FUN;
   v->fun = func;
   return v;
 }
 
+ival* ival_lambda(ival* formals, ival* body) {
+  ilambda* l = malloc(sizeof(ilambda));
+  l->refs = 1;
+  l->formals = formals;
+  l->body = body;
+
+  /* The "&" itself takes no slot */
+  l->locals = ival_qexpr();
+  l->variadic = 0;
+  for (int i = 0; i < formals->count; i++) {
+    if (strcmp(formals->cell[i]->sym, "&") == 0) { l->variadic = 1; continue; }
+    ival_add(l->locals, ival_copy(formals->cell[i]));
+  }
+  l->nparams = l->locals->count;
+
+  l->ncaptured = 0;
+  l->captured = NULL;
+  l->chunk = NULL;
+
+  ival* v = ival_alloc();
+  v->type = IVAL_LAMBDA;
+  v->lambda = l;
+  return v;
+}
+
+ival* ival_memo(imemo* m) {
+  ival* v = ival_alloc();
+  v->type = IVAL_MEMO;
+  v->memo = m;
+  return v;
+}
+
+ival* ival_seq(iseq* s) {
+  ival* v = ival_alloc();
+  v->type = IVAL_SEQ;
+  v->seq = s;
+  return v;
+}
+
+ival* ival_future(ifuture* f) {
+  ival* v = ival_alloc();
+  v->type = IVAL_FUTURE;
+  v->future = f;
+  return v;
+}
+
 ival* ival_sexpr(void) {
-  ival* v = malloc(sizeof(ival));
+  ival* v = ival_alloc();
   v->type = IVAL_SEXPR;
   v->count = 0;
   v->cell = NULL;
+  v->refs = 1;
+  v->quote = NULL;
   return v;
 }
 
 ival* ival_qexpr(void) {
-  ival* v = malloc(sizeof(ival));
+  ival* v = ival_alloc();
   v->type = IVAL_QEXPR;
   v->count = 0;
   v->cell = NULL;
+  v->refs = 1;
+  v->quote = NULL;
   return v;
 }
 
+/* Work Stacks */
+
+void iwork_init(iwork* w) {
+  w->count = 0;
+  w->cap = sizeof(w->local) / sizeof(w->local[0]);
+  w->items = w->local;
+}
+
+void iwork_push(iwork* w, void* x) {
+  if (w->count == w->cap) {
+    w->cap *= 2;
+    if (w->items == w->local) {
+      w->items = malloc(sizeof(void*) * w->cap);
+      memcpy(w->items, w->local, sizeof(w->local));
+    } else {
+      w->items = realloc(w->items, sizeof(void*) * w->cap);
+    }
+  }
+  w->items[w->count++] = x;
+}
+
+void* iwork_pop(iwork* w) { return w->items[--w->count]; }
+
+void iwork_free(iwork* w) {
+  if (w->items != w->local) { free(w->items); }
+}
+
 void ival_del(ival* v) {
 
-  switch (v->type) {
-    case IVAL_NUM: break;
-    case IVAL_FUN: break;
-    case IVAL_ERR: free(v->err); break;
-    case IVAL_SYM: free(v->sym); break;
-    case IVAL_QEXPR:
-    case IVAL_SEXPR:
-      for (int i = 0; i < v->count; i++) {
-        ival_del(v->cell[i]);
-      }
-      free(v->cell);
-    break;
+  /* Numbers and functions are most of what gets deleted, and hold nothing */
+  if (v->type == IVAL_NUM || v->type == IVAL_FUN) {
+    ival_free(v);
+    return;
   }
-  
-  free(v);
+
+  iwork w;
+  iwork_init(&w);
+  iwork_push(&w, v);
+
+  while (w.count) {
+    v = iwork_pop(&w);
+
+    switch (v->type) {
+      case IVAL_NUM: break;
+      case IVAL_FUN: break;
+      case IVAL_ERR: free(v->err); break;
+      case IVAL_SYM: free(v->sym); break;
+
+      /* Lambdas are shared, the last copy frees everything they hold */
+      case IVAL_LAMBDA:
+        if (IREF_DEC(v->lambda->refs) == 0) {
+          ilambda* l = v->lambda;
+          iwork_push(&w, l->formals);
+          iwork_push(&w, l->body);
+          iwork_push(&w, l->locals);
+          for (int i = 0; i < l->ncaptured; i++) { iwork_push(&w, l->captured[i]); }
+          free(l->captured);
+          if (l->chunk) { ichunk_del(l->chunk); }
+          free(l);
+        }
+      break;
+      case IVAL_MEMO: imemo_release(v->memo); break;
+      case IVAL_SEQ: iseq_release(v->seq); break;
+      case IVAL_FUTURE: ifuture_release(v->future); break;
+      case IVAL_QEXPR:
+      case IVAL_SEXPR:
+        /* A shared list is only freed by the last of its holders */
+        if (IREF_DEC(v->refs) > 0) { continue; }
+        for (int i = 0; i < v->count; i++) {
+          iwork_push(&w, v->cell[i]);
+        }
+        free(v->cell);
+        if (v->quote) { iquote_del(v->quote); }
+      break;
+    }
+
+    ival_free(v);
+  }
+
+  iwork_free(&w);
 }
 
-ival* ival_copy(ival* v) {
+/* Copy everything but the children of a list, which are left to the caller */
+ival* ival_copy_node(ival* v) {
 
-  ival* x = malloc(sizeof(ival));
+  ival* x = ival_alloc();
   x->type = v->type;
   
   switch (v->type) {
@@ -92,25 +311,107 @@ ival* ival_copy(ival* v) {
     /* Copy Functions and Numbers Directly */
     case IVAL_FUN: x->fun = v->fun; break;
     case IVAL_NUM: x->num = v->num; break;
+
+    /* Lambdas can't change once made, so copies share one */
+    case IVAL_LAMBDA: x->lambda = v->lambda; IREF_INC(x->lambda->refs); break;
+    case IVAL_MEMO: x->memo = v->memo; IREF_INC(x->memo->refs); break;
+    case IVAL_SEQ: x->seq = v->seq; IREF_INC(x->seq->refs); break;
+    case IVAL_FUTURE: x->future = v->future; IREF_INC(x->future->refs); break;
     
     /* Copy Strings using malloc and strcpy */
-    case IVAL_ERR: x->err = malloc(strlen(v->err) + 1); strcpy(x->err, v->err); break;
+    case IVAL_ERR:
+      x->err = malloc(sizeof(ierror) + v->err->length);
+      memcpy(x->err, v->err, sizeof(ierror) + v->err->length);
+    break;
     case IVAL_SYM: x->sym = malloc(strlen(v->sym) + 1); strcpy(x->sym, v->sym); break;
     
-    /* Copy Lists by copying each sub-expression */
+    /* Allocate Lists, to be filled with copies of each sub-expression */
     case IVAL_SEXPR:
     case IVAL_QEXPR:
       x->count = v->count;
       x->cell = malloc(sizeof(ival*) * x->count);
-      for (int i = 0; i < x->count; i++) {
-        x->cell[i] = ival_copy(v->cell[i]);
-      }
+      x->refs = 1;
+      x->quote = NULL;
     break;
   }
   
   return x;
 }
 
+ival* ival_copy(ival* v) {
+
+  ival* x = ival_copy_node(v);
+  if (v->type != IVAL_SEXPR && v->type != IVAL_QEXPR) { return x; }
+
+  /* Pairs of (source, copy) lists whose children still need copying */
+  iwork w;
+  iwork_init(&w);
+  iwork_push(&w, v);
+  iwork_push(&w, x);
+
+  while (w.count) {
+    ival* to = iwork_pop(&w);
+    ival* from = iwork_pop(&w);
+    for (int i = 0; i < from->count; i++) {
+      to->cell[i] = ival_copy_node(from->cell[i]);
+      if (from->cell[i]->type == IVAL_SEXPR || from->cell[i]->type == IVAL_QEXPR) {
+        iwork_push(&w, from->cell[i]);
+        iwork_push(&w, to->cell[i]);
+      }
+    }
+  }
+
+  iwork_free(&w);
+  return x;
+}
+
+/* Another holder of a value. Lists are shared rather than copied, everything else is small enough to copy */
+ival* ival_share(ival* v) {
+  if (v->type != IVAL_SEXPR && v->type != IVAL_QEXPR) { return ival_copy(v); }
+  IREF_INC(v->refs);
+  return v;
+}
+
+/* A list which is safe to change: v itself if nothing else holds it, or else a copy in its place */
+ival* ival_own(ival* v) {
+  if (v->type != IVAL_SEXPR && v->type != IVAL_QEXPR) { return v; }
+
+  /* Whatever it compiled to won't hold once it is changed */
+  if (IREF_GET(v->refs) == 1) {
+    if (v->quote) {
+      iquote_del(v->quote);
+      v->quote = NULL;
+    }
+    return v;
+  }
+
+  /* Copied before letting go, as another holder may let go at the same time and be left to free it */
+  ival* x = ival_copy(v);
+  ival_del(v);
+  return x;
+}
+
+/* Own every list in a tree, before taking it apart */
+ival* ival_unshare(ival* v) {
+  v = ival_own(v);
+
+  iwork w;
+  iwork_init(&w);
+  iwork_push(&w, v);
+
+  while (w.count) {
+    ival* x = iwork_pop(&w);
+    if (x->type != IVAL_SEXPR && x->type != IVAL_QEXPR) { continue; }
+    for (int i = 0; i < x->count; i++) {
+      x->cell[i] = ival_own(x->cell[i]);
+      iwork_push(&w, x->cell[i]);
+    }
+  }
+
+  iwork_free(&w);
+  return v;
+}
+
 ival* ival_add(ival* v, ival* x) {
   v->count++;
   v->cell = realloc(v->cell, sizeof(ival*) * v->count);
@@ -119,11 +420,19 @@ ival* ival_add(ival* v, ival* x) {
 }
 
 ival* ival_join(ival* x, ival* y) {  
+  /* Children of a shared list are shared in turn */
+  if (IREF_GET(y->refs) > 1) {
+    for (int i = 0; i < y->count; i++) { x = ival_add(x, ival_share(y->cell[i])); }
+    ival_del(y);
+    return x;
+  }
+
   for (int i = 0; i < y->count; i++) {
     x = ival_add(x, y->cell[i]);
   }
   free(y->cell);
-  free(y);  
+  if (y->quote) { iquote_del(y->quote); }
+  ival_free(y);
   return x;
 }
 
@@ -141,35 +450,85 @@ ival* ival_take(ival* v, int i) {
   return x;
 }
 
-void ival_print(ival* v);
+void ival_print(ival* v) {
+
+  /* Pairs of (value, character), a NULL value means just print the character */
+  iwork w;
+  iwork_init(&w);
+  iwork_push(&w, v);
+  iwork_push(&w, NULL);
+
+  while (w.count) {
+    char c = (char)(intptr_t)iwork_pop(&w);
+    v = iwork_pop(&w);
+    if (!v) { putchar(c); continue; }
+
+    char open = '(', close = ')';
+    switch (v->type) {
+      case IVAL_FUN:   printf("<function>"); continue;
+      case IVAL_NUM:   printf("%li", v->num); continue;
+      case IVAL_ERR:   printf("Error: "); ierror_print(v->err); continue;
+      case IVAL_SYM:   printf("%s", v->sym); continue;
+      case IVAL_MEMO:  printf("<memo>"); continue;
+      case IVAL_SEQ:   printf("<sequence>"); continue;
+      case IVAL_FUTURE: printf("<future>"); continue;
+      case IVAL_LAMBDA:
+        printf("(\\ ");
+        iwork_push(&w, NULL);
+        iwork_push(&w, (void*)(intptr_t)')');
+        iwork_push(&w, v->lambda->body);
+        iwork_push(&w, NULL);
+        iwork_push(&w, NULL);
+        iwork_push(&w, (void*)(intptr_t)' ');
+        iwork_push(&w, v->lambda->formals);
+        iwork_push(&w, NULL);
+      continue;
+      case IVAL_SEXPR: break;
+      case IVAL_QEXPR: open = '{'; close = '}'; break;
+      default: continue;
+    }
 
-void ival_print_expr(ival* v, char open, char close) {
-  putchar(open);
-  for (int i = 0; i < v->count; i++) {
-    ival_print(v->cell[i]);    
-    if (i != (v->count-1)) {
-      putchar(' ');
+    /* Children are pushed in reverse so they come off in order */
+    putchar(open);
+    iwork_push(&w, NULL);
+    iwork_push(&w, (void*)(intptr_t)close);
+    for (int i = v->count-1; i >= 0; i--) {
+      if (i != (v->count-1)) {
+        iwork_push(&w, NULL);
+        iwork_push(&w, (void*)(intptr_t)' ');
+      }
+      iwork_push(&w, v->cell[i]);
+      iwork_push(&w, NULL);
     }
   }
-  putchar(close);
+
+  iwork_free(&w);
 }
 
-void ival_print(ival* v) {
+void ival_println(ival* v) { ival_print(v); putchar('\n'); }
+
+int ival_callable(ival* v) {
+  return v->type == IVAL_FUN || v->type == IVAL_LAMBDA || v->type == IVAL_MEMO;
+}
+
+/* Zero and empty lists are false, anything else is true */
+int ival_truthy(ival* v) {
   switch (v->type) {
-    case IVAL_FUN:   printf("<function>"); break;
-    case IVAL_NUM:   printf("%li", v->num); break;
-    case IVAL_ERR:   printf("Error: %s", v->err); break;
-    case IVAL_SYM:   printf("%s", v->sym); break;
-    case IVAL_SEXPR: ival_print_expr(v, '(', ')'); break;
-    case IVAL_QEXPR: ival_print_expr(v, '{', '}'); break;
+    case IVAL_NUM: return v->num != 0;
+    case IVAL_SEXPR:
+    case IVAL_QEXPR: return v->count != 0;
+    case IVAL_SEQ: return !iseq_empty(v->seq);
+    default: return 1;
   }
 }
 
-void ival_println(ival* v) { ival_print(v); putchar('\n'); }
-
 char* ltype_name(int t) {
   switch(t) {
     case IVAL_FUN: return "Function";
+    case IVAL_LAMBDA: return "Function";
+    case IVAL_MEMO: return "Memo";
+    case IVAL_SEQ: return "Sequence";
+    case IVAL_FUTURE: return "Future";
     case IVAL_NUM: return "Number";
     case IVAL_ERR: return "Error";
     case IVAL_SYM: return "Symbol";
@@ -187,6 +546,8 @@ ienv* ienv_new(void) {
   e->count = 0;
   e->syms = NULL;
   e->vals = NULL;
+  e->react = NULL;
+  e->redefs = 0;
   return e;
   
 }
@@ -202,16 +563,25 @@ void ienv_del(ienv* e) {
   /* Free allocated memory for lists */
   free(e->syms);
   free(e->vals);
+  if (e->react) { ireact_del(e->react); }
   free(e);
 }
 
+/* Position of a symbol in the environment, or -1 if it is unbound */
+int ienv_slot(ienv* e, ival* k) {
+  for (int i = 0; i < e->count; i++) {
+    if (strcmp(e->syms[i], k->sym) == 0) { return i; }
+  }
+  return -1;
+}
+
 ival* ienv_get(ienv* e, ival* k) {
   
   /* Iterate over all items in environment */
   for (int i = 0; i < e->count; i++) {
     /* Check if the stored string matches the symbol string */
-    /* If it does, return a copy of the value */
-    if (strcmp(e->syms[i], k->sym) == 0) { return ival_copy(e->vals[i]); }
+    /* If it does, return the value, sharing rather than copying lists */
+    if (strcmp(e->syms[i], k->sym) == 0) { return ival_share(e->vals[i]); }
   }
   /* If no symbol found return error */
   return ival_err("Unbound Symbol '%s'", k->sym);
@@ -228,6 +598,7 @@ void ienv_put(ienv* e, ival* k, ival* v) {
     if (strcmp(e->syms[i], k->sym) == 0) {
       ival_del(e->vals[i]);
       e->vals[i] = ival_copy(v);
+      IREF_INC(e->redefs);
       return;
     }
   }
@@ -262,6 +633,17 @@ void ienv_put(ienv* e, ival* k, ival* v) {
   LASSERT(args, args->cell[index]->count != 0, \
     "Function '%s' passed {} for argument %i.", func, index);
 
+#define LASSERT_FUN(func, args, index) \
+  LASSERT(args, ival_callable(args->cell[index]), \
+    "Function '%s' passed incorrect type for argument %i. Got %s, Expected %s.", \
+    func, index, ltype_name(args->cell[index]->type), ltype_name(IVAL_FUN))
+
+/* Sequences go wherever a Q-Expression can be read from front to back */
+#define LASSERT_LIST(func, args, index) \
+  LASSERT(args, args->cell[index]->type == IVAL_QEXPR || args->cell[index]->type == IVAL_SEQ, \
+    "Function '%s' passed incorrect type for argument %i. Got %s, Expected %s.", \
+    func, index, ltype_name(args->cell[index]->type), ltype_name(IVAL_QEXPR))
+
 
 ival* ival_eval(ienv* e, ival* v);
 
@@ -272,40 +654,90 @@ ival* builtin_list(ienv* e, ival* a) {
 
 ival* builtin_head(ienv* e, ival* a) {
   LASSERT_NUM("head", a, 1);
-  LASSERT_TYPE("head", a, 0, IVAL_QEXPR);
+  LASSERT_LIST("head", a, 0);
+
+  if (a->cell[0]->type == IVAL_SEQ) {
+    ival* x = iseq_first(a->cell[0]->seq);
+    LASSERT(a, x, "Function 'head' passed {} for argument 0.");
+    ival_del(a);
+    return ival_add(ival_qexpr(), x);
+  }
+
+  return builtin_head_unchecked(e, a);
+}
+
+ival* builtin_head_unchecked(ienv* e, ival* a) {
   LASSERT_NOT_EMPTY("head", a, 0);
   
-  ival* v = ival_take(a, 0);  
+  ival* v = ival_own(ival_take(a, 0));
   while (v->count > 1) { ival_del(ival_pop(v, 1)); }
   return v;
 }
 
 ival* builtin_tail(ienv* e, ival* a) {
   LASSERT_NUM("tail", a, 1);
-  LASSERT_TYPE("tail", a, 0, IVAL_QEXPR);
+  LASSERT_LIST("tail", a, 0);
+
+  if (a->cell[0]->type == IVAL_SEQ) {
+    LASSERT(a, !iseq_empty(a->cell[0]->seq), "Function 'tail' passed {} for argument 0.");
+    ival* v = ival_take(a, 0);
+    v->seq = iseq_own(v->seq);
+    ival* err = iseq_next(e, v->seq);
+    if (err) {
+      ival_del(v);
+      return err;
+    }
+    return v;
+  }
+
+  return builtin_tail_unchecked(e, a);
+}
+
+ival* builtin_tail_unchecked(ienv* e, ival* a) {
   LASSERT_NOT_EMPTY("tail", a, 0);
 
-  ival* v = ival_take(a, 0);  
+  ival* v = ival_own(ival_take(a, 0));
   ival_del(ival_pop(v, 0));
   return v;
 }
 
-ival* builtin_eval(ienv* e, ival* a) {
+/* Check the arguments to eval, returning the expression it should run */
+ival* builtin_eval_expr(ival* a) {
   LASSERT_NUM("eval", a, 1);
-  LASSERT_TYPE("tail", a, 0, IVAL_QEXPR);
+  LASSERT_TYPE("eval", a, 0, IVAL_QEXPR);
   
-  ival* x = ival_take(a, 0);
+  ival* x = ival_own(ival_take(a, 0));
   x->type = IVAL_SEXPR;
+  return x;
+}
+
+ival* builtin_eval(ienv* e, ival* a) {
+  ival* x = builtin_eval_expr(a);
+  if (x->type == IVAL_ERR) { return x; }
   return ival_eval(e, x);
 }
 
 ival* builtin_join(ienv* e, ival* a) {
   
-  for (int i = 0; i < a->count; i++) { LASSERT_TYPE("join", a, i, IVAL_QEXPR); }
-  
-  ival* x = ival_pop(a, 0);
+  for (int i = 0; i < a->count; i++) { LASSERT_LIST("join", a, i); }
+
+  /* Joining any sequence gives another, so nothing is made until it is stepped through */
+  for (int i = 0; i < a->count; i++) {
+    if (a->cell[i]->type == IVAL_SEQ) { return ival_seq(iseq_join(a)); }
+  }
+  return builtin_join_unchecked(e, a);
+}
+
+ival* builtin_join_unchecked(ienv* e, ival* a) {
+  ival* x = ival_own(ival_pop(a, 0));
   
   while (a->count) {
+    ival* err = ival_interrupted();
+    if (err) {
+      ival_del(x);
+      ival_del(a);
+      return err;
+    }
     ival* y = ival_pop(a, 0);
     x = ival_join(x, y);
   }
@@ -314,39 +746,275 @@ ival* builtin_join(ienv* e, ival* a) {
   return x;
 }
 
-ival* builtin_op(ienv* e, ival* a, char* op) {
-  
-  for (int i = 0; i < a->count; i++) { LASSERT_TYPE(op, a, i, IVAL_NUM); }
-  
-  ival* x = ival_pop(a, 0);
-  
-  if ((strcmp(op, "-") == 0) && a->count == 0) { x->num = -x->num; }
-  
-  while (a->count > 0) {  
-    ival* y = ival_pop(a, 0);
-    
-    if (strcmp(op, "+") == 0) { x->num += y->num; }
-    if (strcmp(op, "-") == 0) { x->num -= y->num; }
-    if (strcmp(op, "*") == 0) { x->num *= y->num; }
-    if (strcmp(op, "/") == 0) {
-      if (y->num != 0) {
-        ival_del(x); ival_del(y);
-        return ival_err("Division By Zero.");
-      }
-      x->num /= y->num;
-    }
-    
-    ival_del(y);
+/* Sequences */
+
+ival* builtin_range(ienv* e, ival* a) {
+  LASSERT(a, a->count >= 1 && a->count <= 3,
+    "Function 'range' passed incorrect number of arguments. Got %i, Expected 1 to 3.", a->count);
+  for (int i = 0; i < a->count; i++) { LASSERT_TYPE("range", a, i, IVAL_NUM); }
+
+  /* Just an end counts from 0, and the step defaults to 1 */
+  long at = a->count > 1 ? a->cell[0]->num : 0;
+  long end = a->count > 1 ? a->cell[1]->num : a->cell[0]->num;
+  long step = a->count > 2 ? a->cell[2]->num : 1;
+  LASSERT(a, step != 0, "Function 'range' passed a step of 0.");
+
+  ival_del(a);
+  return ival_seq(iseq_range(at, end, step));
+}
+
+/* x, then f x, then f (f x) and so on forever */
+ival* builtin_iterate(ienv* e, ival* a) {
+  LASSERT_NUM("iterate", a, 2);
+  LASSERT_FUN("iterate", a, 0);
+
+  ival* f = ival_pop(a, 0);
+  return ival_seq(iseq_iterate(f, ival_take(a, 0)));
+}
+
+/*
+** Higher order functions, over Q-Expressions or sequences. Each is a pipeline
+** of one stage, and the compiler passes chains of them to builtin_pipe so
+** they run as one.
+*/
+
+ival* builtin_map(ienv* e, ival* a) {
+  LASSERT_NUM("map", a, 2);
+  LASSERT_FUN("map", a, 0);
+  LASSERT_LIST("map", a, 1);
+
+  ival* f = ival_pop(a, 0);
+  return iseq_pipe(e, ival_qexpr(), IPIPE_MAP, f, NULL, ival_take(a, 0));
+}
+
+ival* builtin_filter(ienv* e, ival* a) {
+  LASSERT_NUM("filter", a, 2);
+  LASSERT_FUN("filter", a, 0);
+  LASSERT_LIST("filter", a, 1);
+
+  ival* f = ival_pop(a, 0);
+  return iseq_pipe(e, ival_qexpr(), IPIPE_FILTER, f, NULL, ival_take(a, 0));
+}
+
+/* f (f (f init x0) x1) x2 and so on */
+ival* builtin_fold(ienv* e, ival* a) {
+  LASSERT_NUM("fold", a, 3);
+  LASSERT_FUN("fold", a, 0);
+  LASSERT_LIST("fold", a, 2);
+
+  ival* f = ival_pop(a, 0);
+  ival* init = ival_pop(a, 0);
+  return iseq_pipe(e, ival_qexpr(), IPIPE_FOLD, f, init, ival_take(a, 0));
+}
+
+/* A fold starting from the first element, which there must be */
+ival* builtin_reduce(ienv* e, ival* a) {
+  LASSERT_NUM("reduce", a, 2);
+  LASSERT_FUN("reduce", a, 0);
+  LASSERT_LIST("reduce", a, 1);
+  LASSERT(a, ival_truthy(a->cell[1]), "Function 'reduce' passed {} for argument 1.");
+
+  ival* f = ival_pop(a, 0);
+  return iseq_pipe(e, ival_qexpr(), IPIPE_REDUCE, f, NULL, ival_take(a, 0));
+}
+
+/* The grain, if given, is how many elements go to each task */
+#define LASSERT_GRAIN(func, args) \
+  LASSERT(args, args->count == 2 || args->count == 3, \
+    "Function '%s' passed incorrect number of arguments. Got %i, Expected 2 or 3.", func, args->count); \
+  if (args->count == 3) { \
+    LASSERT_TYPE(func, args, 2, IVAL_NUM); \
+    LASSERT(args, args->cell[2]->num > 0, \
+      "Function '%s' passed a grain of %li, Expected at least 1.", func, args->cell[2]->num); \
   }
-  
+
+/* A map split between the threads of the pool */
+ival* builtin_pmap(ienv* e, ival* a) {
+  LASSERT_GRAIN("pmap", a);
+  LASSERT_FUN("pmap", a, 0);
+  LASSERT_LIST("pmap", a, 1);
+
+  long grain = a->count == 3 ? a->cell[2]->num : 0;
+  if (a->count == 3) { ival_del(ival_pop(a, 2)); }
+  ival* f = ival_pop(a, 0);
+  return iseq_par(e, IPIPE_MAP, f, ival_take(a, 0), grain);
+}
+
+/* A reduce split between the threads of the pool, for functions where the grouping doesn't matter */
+ival* builtin_preduce(ienv* e, ival* a) {
+  LASSERT_GRAIN("preduce", a);
+  LASSERT_FUN("preduce", a, 0);
+  LASSERT_LIST("preduce", a, 1);
+  LASSERT(a, ival_truthy(a->cell[1]), "Function 'preduce' passed {} for argument 1.");
+
+  long grain = a->count == 3 ? a->cell[2]->num : 0;
+  if (a->count == 3) { ival_del(ival_pop(a, 2)); }
+  ival* f = ival_pop(a, 0);
+  return iseq_par(e, IPIPE_REDUCE, f, ival_take(a, 0), grain);
+}
+
+/* Futures */
+
+/* Start applying a function to its arguments on the pool, giving a future of the result */
+ival* builtin_spawn(ienv* e, ival* a) {
+  LASSERT(a, a->count > 0, "Function 'spawn' passed no arguments.");
+  LASSERT_FUN("spawn", a, 0);
+  return ival_future(ifuture_new(e, a));
+}
+
+/* The result of a future, waiting for it or working it out here if need be */
+ival* builtin_await(ienv* e, ival* a) {
+  LASSERT_NUM("await", a, 1);
+  LASSERT_TYPE("await", a, 0, IVAL_FUTURE);
+
+  ival* x = ifuture_await(a->cell[0]->future);
   ival_del(a);
   return x;
 }
 
-ival* builtin_add(ienv* e, ival* a) { return builtin_op(e, a, "+"); }
-ival* builtin_sub(ienv* e, ival* a) { return builtin_op(e, a, "-"); }
-ival* builtin_mul(ienv* e, ival* a) { return builtin_op(e, a, "*"); }
-ival* builtin_div(ienv* e, ival* a) { return builtin_op(e, a, "/"); }
+/*
+** A chain such as (map f (filter p (map g xs))), flattened by the compiler to
+** the number of arguments of the outer call, then each call's function and
+** arguments from the outside in, then xs. Run as one pipeline if every one is
+** still the builtin it was compiled for and would accept its arguments, or
+** else one call at a time from the inside out just as written.
+*/
+ival* builtin_pipe(ienv* e, ival* a) {
+  int k = a->cell[0]->num;
+  int n = a->count;
+  ival** c = a->cell;
+  ival* xs = c[n-1];
+
+  ibuiltin outer = c[1]->type == IVAL_FUN ? c[1]->fun : NULL;
+  int fused = (k == 1 && (outer == builtin_map || outer == builtin_filter || outer == builtin_reduce))
+    || (k == 2 && outer == builtin_fold);
+  fused = fused && ival_callable(c[2]) && (xs->type == IVAL_QEXPR || xs->type == IVAL_SEQ);
+  for (int i = 2 + k; fused && i < n-1; i += 2) {
+    fused = c[i]->type == IVAL_FUN && (c[i]->fun == builtin_map || c[i]->fun == builtin_filter)
+      && ival_callable(c[i+1]);
+  }
+
+  if (!fused) {
+    for (int i = n-3; i >= 2 + k; i -= 2) {
+      ival* args[] = { c[i], c[i+1], xs };
+      xs = ivm_call(e, args, 3);
+    }
+    c[2 + k] = xs;
+    ival_del(c[0]);
+    ival_free(a);
+    ival* x = ivm_call(e, c + 1, k + 2);
+    free(c);
+    return x;
+  }
+
+  /* Innermost first */
+  ival* stages = ival_qexpr();
+  for (int i = n-3; i >= 2 + k; i -= 2) {
+    ival_add(stages, ival_num(c[i]->fun == builtin_map ? IPIPE_MAP : IPIPE_FILTER));
+    ival_add(stages, c[i+1]);
+    ival_del(c[i]);
+  }
+  int sink = outer == builtin_map ? IPIPE_MAP : outer == builtin_filter ? IPIPE_FILTER
+    : outer == builtin_fold ? IPIPE_FOLD : IPIPE_REDUCE;
+  ival* init = k == 2 ? c[3] : NULL;
+  ival* f = c[2];
+  ival_del(c[0]);
+  ival_del(c[1]);
+  free(c);
+  ival_free(a);
+  return iseq_pipe(e, stages, sink, f, init, xs);
+}
+
+/*
+** Arithmetic kernels. Each checks every argument is a number in one pass,
+** then reduces straight over the cell array, reusing the first argument
+** for the result and releasing the rest along with the list itself.
+*/
+
+#define LASSERT_NUMS(func, args) \
+  LASSERT(args, args->count > 0, "Function '%s' passed no arguments.", func); \
+  for (int i = 0; i < args->count; i++) { LASSERT_TYPE(func, args, i, IVAL_NUM); }
+
+/* A lone sequence is reduced over as though its elements were the arguments */
+#define LREDUCE_SEQ(args, self) \
+  if (args->count == 1 && args->cell[0]->type == IVAL_SEQ) { return iseq_reduce(e, ival_take(args, 0), self); }
+
+ival* builtin_reduced(ival* a, long r) {
+  ival* x = a->cell[0];
+  x->num = r;
+  for (int i = 1; i < a->count; i++) { ival_del(a->cell[i]); }
+  free(a->cell);
+  ival_free(a);
+  return x;
+}
+
+ival* builtin_add(ienv* e, ival* a) {
+  LREDUCE_SEQ(a, builtin_add);
+  LASSERT_NUMS("+", a);
+  return builtin_add_unchecked(e, a);
+}
+
+ival* builtin_add_unchecked(ienv* e, ival* a) {
+  ival** c = a->cell;
+  if (a->count == 2) { return builtin_reduced(a, IARITH_WRAP(c[0]->num, +, c[1]->num)); }
+
+  long r = c[0]->num;
+  for (int i = 1; i < a->count; i++) { r = IARITH_WRAP(r, +, c[i]->num); }
+  return builtin_reduced(a, r);
+}
+
+ival* builtin_sub(ienv* e, ival* a) {
+  LREDUCE_SEQ(a, builtin_sub);
+  LASSERT_NUMS("-", a);
+  return builtin_sub_unchecked(e, a);
+}
+
+ival* builtin_sub_unchecked(ienv* e, ival* a) {
+  ival** c = a->cell;
+  if (a->count == 1) { return builtin_reduced(a, IARITH_WRAP(0, -, c[0]->num)); }
+  if (a->count == 2) { return builtin_reduced(a, IARITH_WRAP(c[0]->num, -, c[1]->num)); }
+
+  long r = c[0]->num;
+  for (int i = 1; i < a->count; i++) { r = IARITH_WRAP(r, -, c[i]->num); }
+  return builtin_reduced(a, r);
+}
+
+ival* builtin_mul(ienv* e, ival* a) {
+  LREDUCE_SEQ(a, builtin_mul);
+  LASSERT_NUMS("*", a);
+  return builtin_mul_unchecked(e, a);
+}
+
+ival* builtin_mul_unchecked(ienv* e, ival* a) {
+  ival** c = a->cell;
+  if (a->count == 2) { return builtin_reduced(a, IARITH_WRAP(c[0]->num, *, c[1]->num)); }
+
+  long r = c[0]->num;
+  for (int i = 1; i < a->count; i++) { r = IARITH_WRAP(r, *, c[i]->num); }
+  return builtin_reduced(a, r);
+}
+
+ival* builtin_div(ienv* e, ival* a) {
+  LREDUCE_SEQ(a, builtin_div);
+  LASSERT_NUMS("/", a);
+  return builtin_div_unchecked(e, a);
+}
+
+ival* builtin_div_unchecked(ienv* e, ival* a) {
+  ival** c = a->cell;
+  for (int i = 1; i < a->count; i++) {
+    LASSERT(a, c[i]->num != 0, "Division By Zero.");
+  }
+  if (a->count == 2 && c[1]->num != -1) { return builtin_reduced(a, c[0]->num / c[1]->num); }
+
+  /* The one quotient too big for a long, which traps rather than wrapping */
+  long r = c[0]->num;
+  for (int i = 1; i < a->count; i++) {
+    LASSERT(a, r != LONG_MIN || c[i]->num != -1, "Integer Overflow.");
+    r /= c[i]->num;
+  }
+  return builtin_reduced(a, r);
+}
 
 ival* builtin_def(ienv* e, ival* a) {
 
@@ -367,15 +1035,192 @@ ival* builtin_def(ienv* e, ival* a) {
     "Function 'def' passed too many arguments for symbols. Got %i, Expected %i.",
     syms->count, a->count-1);
   
+  /* Other threads read the environment without locking it, so any still running are waited for */
+  LASSERT(a, !ipool_busy(), "Function 'def' cannot define while evaluating in parallel.");
+  ipool_quiet();
+
+  /* Special forms are compiled in place wherever they are named, so must keep their meaning */
+  for (int i = 0; i < syms->count; i++) {
+    LASSERT(a, !iscope_form(e, NULL, syms->cell[i]),
+      "Function 'def' cannot redefine special form '%s'.", syms->cell[i]->sym);
+  }
+
   /* Assign copies of values to symbols */
   for (int i = 0; i < syms->count; i++) {
     ienv_put(e, syms->cell[i], a->cell[i+1]);
   }
+
+  /* Definitions made from these are made again */
+  ireact_changed(e, syms);
   
   ival_del(a);
   return ival_sexpr();
 }
 
+ival* builtin_lambda(ienv* e, ival* a) {
+  LASSERT_NUM("\\", a, 2);
+  LASSERT_TYPE("\\", a, 0, IVAL_QEXPR);
+  LASSERT_TYPE("\\", a, 1, IVAL_QEXPR);
+
+  /* Formals must all be symbols, with at most one following an "&" at the end */
+  ival* syms = a->cell[0];
+  LASSERT(a, syms->count > 0,
+    "Function '\\' passed {} for argument 0. A call with no arguments gives the function rather than calling it.");
+  for (int i = 0; i < syms->count; i++) {
+    LASSERT(a, (syms->cell[i]->type == IVAL_SYM),
+      "Cannot define non-symbol. Got %s, Expected %s.",
+      ltype_name(syms->cell[i]->type), ltype_name(IVAL_SYM));
+    LASSERT(a, strcmp(syms->cell[i]->sym, "&") != 0 || i == syms->count-2,
+      "Function '\\' format invalid. Symbol '&' not followed by single symbol.");
+  }
+
+  ival* formals = ival_pop(a, 0);
+  ival* body = ival_take(a, 0);
+  return ival_lambda(formals, body);
+}
+
+/*
+** Counted loops. dotimes {i x} n x0 {body} runs body for i from 0 up to n,
+** with x the value it gave last time, starting as x0, and gives the last of
+** them. Without x the values are only passed on, starting as (). The body
+** giving the builtin stop itself ends the loop early, leaving the value
+** before, and an error ends it with that error. Nothing else does, so bodies
+** ending in a def, or an if without an else, giving () run every time.
+*/
+
+ival* builtin_dotimes_lambda(ival* a, long* count, ival** start) {
+  LASSERT(a, a->count == 3 || a->count == 4,
+    "Function 'dotimes' passed incorrect number of arguments. Got %i, Expected 3 or 4.", a->count);
+  LASSERT_TYPE("dotimes", a, 0, IVAL_QEXPR);
+  LASSERT_TYPE("dotimes", a, 1, IVAL_NUM);
+  LASSERT_TYPE("dotimes", a, a->count-1, IVAL_QEXPR);
+
+  int named = a->count == 4;
+  ival* syms = a->cell[0];
+  LASSERT(a, syms->count == 1 + named,
+    "Function 'dotimes' passed %i symbols, Expected %i.", syms->count, 1 + named);
+  for (int i = 0; i < syms->count; i++) {
+    LASSERT(a, syms->cell[i]->type == IVAL_SYM && strcmp(syms->cell[i]->sym, "&") != 0,
+      "Function 'dotimes' cannot bind %s.", syms->cell[i]->type == IVAL_SYM ? "&" : ltype_name(syms->cell[i]->type));
+  }
+
+  /* Without a name the value goes in a second slot under the first name, only the first of which is ever found */
+  ival* formals = ival_own(ival_pop(a, 0));
+  if (!named) { ival_add(formals, ival_copy(formals->cell[0])); }
+  *count = a->cell[0]->num;
+  *start = named ? ival_pop(a, 1) : ival_sexpr();
+  ival* body = ival_take(a, 1);
+  return ival_lambda(formals, body);
+}
+
+int ival_stops(ival* x) {
+  return x->type == IVAL_FUN && x->fun == builtin_stop;
+}
+
+/* Only ever meant as a value, which nothing gives by accident */
+ival* builtin_stop(ienv* e, ival* a) {
+  ival_del(a);
+  return ival_err("Function 'stop' ends a loop when its body gives it, rather than being called.");
+}
+
+/* The VM runs loops in a single frame, this is for calls made any other way */
+ival* builtin_dotimes(ienv* e, ival* a) {
+  long count;
+  ival* x;
+  ival* f = builtin_dotimes_lambda(a, &count, &x);
+  if (f->type == IVAL_ERR) { return f; }
+
+  for (long i = 0; i < count; i++) {
+    ival* args[] = { ival_copy(f), ival_num(i), ival_copy(x) };
+    ival* y = ivm_call(e, args, 3);
+    if (ival_stops(y)) {
+      ival_del(y);
+      break;
+    }
+    ival_del(x);
+    x = y;
+    if (x->type == IVAL_ERR) { break; }
+  }
+
+  ival_del(f);
+  return x;
+}
+
+/*
+** Conditionals. Called by name these are special forms, compiled so that only
+** what is needed gets evaluated. Called any other way, for instance through
+** another symbol bound to them, everything has been evaluated already and they
+** just choose a value.
+*/
+
+ival* builtin_if(ienv* e, ival* a) {
+  LASSERT(a, a->count == 2 || a->count == 3,
+    "Function 'if' passed incorrect number of arguments. Got %i, Expected 2 or 3.", a->count);
+
+  int i = ival_truthy(a->cell[0]) ? 1 : 2;
+  if (i == a->count) {
+    ival_del(a);
+    return ival_sexpr();
+  }
+  return ival_take(a, i);
+}
+
+/* The first false value, or else the last */
+ival* builtin_and(ienv* e, ival* a) {
+  if (a->count == 0) {
+    ival_del(a);
+    return ival_num(1);
+  }
+  int i = 0;
+  while (i < a->count-1 && ival_truthy(a->cell[i])) { i++; }
+  return ival_take(a, i);
+}
+
+/* The first true value, or else the last */
+ival* builtin_or(ienv* e, ival* a) {
+  if (a->count == 0) {
+    ival_del(a);
+    return ival_num(0);
+  }
+  int i = 0;
+  while (i < a->count-1 && !ival_truthy(a->cell[i])) { i++; }
+  return ival_take(a, i);
+}
+
+ival* builtin_memo(ienv* e, ival* a) {
+  LASSERT(a, a->count >= 1 && a->count <= 3,
+    "Function 'memo' passed incorrect number of arguments. Got %i, Expected 1 to 3.", a->count);
+
+  LASSERT_FUN("memo", a, 0);
+
+  /* Optionally the most entries and the most values in total to keep */
+  for (int i = 1; i < a->count; i++) {
+    LASSERT_TYPE("memo", a, i, IVAL_NUM);
+    LASSERT(a, a->cell[i]->num > 0, "Function 'memo' passed a limit of %li, Expected more than 0.", a->cell[i]->num);
+  }
+  int entries = a->count > 1 ? (int)(a->cell[1]->num < INT_MAX ? a->cell[1]->num : INT_MAX) : IMEMO_ENTRIES;
+  long nodes = a->count > 2 ? a->cell[2]->num : IMEMO_NODES;
+
+  imemo* m = imemo_new(ival_pop(a, 0), entries, nodes);
+  ival_del(a);
+  return ival_memo(m);
+}
+
+ival* builtin_memo_stats(ienv* e, ival* a) {
+  LASSERT_NUM("memo-stats", a, 1);
+  LASSERT_TYPE("memo-stats", a, 0, IVAL_MEMO);
+
+  imemo* m = a->cell[0]->memo;
+  ival* x = ival_qexpr();
+  ilock_take(&m->lock);
+  ival_add(x, ival_num(m->hits));
+  ival_add(x, ival_num(m->misses));
+  ival_add(x, ival_num(m->count));
+  ilock_drop(&m->lock);
+  ival_del(a);
+  return x;
+}
+
 void ienv_add_builtin(ienv* e, char* name, ibuiltin func) {
   ival* k = ival_sym(name);
   ival* v = ival_fun(func);
@@ -386,62 +1231,55 @@ void ienv_add_builtin(ienv* e, char* name, ibuiltin func) {
 void ienv_add_builtins(ienv* e) {
   /* Variable Functions */
   ienv_add_builtin(e, "def",  builtin_def);
+  ienv_add_builtin(e, "\\",   builtin_lambda);
+  /* Conditionals */
+  ienv_add_builtin(e, "if",   builtin_if);
+  ienv_add_builtin(e, "and",  builtin_and); ienv_add_builtin(e, "or",    builtin_or);
+
+  /* Loops */
+  ienv_add_builtin(e, "dotimes", builtin_dotimes); ienv_add_builtin(e, "stop", builtin_stop);
+
+  ienv_add_builtin(e, "memo", builtin_memo); ienv_add_builtin(e, "memo-stats", builtin_memo_stats);
   
   /* List Functions */
   ienv_add_builtin(e, "list", builtin_list);
   ienv_add_builtin(e, "head", builtin_head); ienv_add_builtin(e, "tail",  builtin_tail);
   ienv_add_builtin(e, "eval", builtin_eval); ienv_add_builtin(e, "join",  builtin_join);
+
+  /* Sequences */
+  ienv_add_builtin(e, "range", builtin_range); ienv_add_builtin(e, "iterate", builtin_iterate);
+  ienv_add_builtin(e, "map",   builtin_map);   ienv_add_builtin(e, "filter",  builtin_filter);
+  ienv_add_builtin(e, "fold",  builtin_fold);  ienv_add_builtin(e, "reduce",  builtin_reduce);
+  ienv_add_builtin(e, "pmap",  builtin_pmap);  ienv_add_builtin(e, "preduce", builtin_preduce);
+  ienv_add_builtin(e, "spawn", builtin_spawn); ienv_add_builtin(e, "await",   builtin_await);
   
   /* Mathematical Functions */
   ienv_add_builtin(e, "+",    builtin_add); ienv_add_builtin(e, "-",     builtin_sub);
   ienv_add_builtin(e, "*",    builtin_mul); ienv_add_builtin(e, "/",     builtin_div);
 }
 
-/* Evaluation */
+/* Reading */
 
-ival* ival_eval_sexpr(ienv* e, ival* v) {
-  
-  for (int i = 0; i < v->count; i++) { v->cell[i] = ival_eval(e, v->cell[i]); }
-  for (int i = 0; i < v->count; i++) { if (v->cell[i]->type == IVAL_ERR) { return ival_take(v, i); } }
-  
-  if (v->count == 0) { return v; }  
-  if (v->count == 1) { return ival_take(v, 0); }
-  
-  /* Ensure first element is a function after evaluation */
-  ival* f = ival_pop(v, 0);
-  if (f->type != IVAL_FUN) {
-    ival* err = ival_err(
-      "S-Expression starts with incorrect type. Got %s, Expected %s.",
-      ltype_name(f->type), ltype_name(IVAL_FUN));
-    ival_del(f); ival_del(v);
-    return err;
-  }
-  
-  /* If so call function to get result */
-  ival* result = f->fun(e, v);
-  ival_del(f);
-  return result;
-}
+/* The parser recurses, and slows, with every level of nesting, so input deeper than this is refused before it sees it */
+#define IVAL_NESTING 10000
 
-ival* ival_eval(ienv* e, ival* v) {
-  if (v->type == IVAL_SYM) {
-    ival* x = ienv_get(e, v);
-    ival_del(v);
-    return x;
+ival* ival_read_depth(char* s) {
+  int depth = 0;
+  for (; *s; s++) {
+    if (*s == '(' || *s == '{') { depth++; }
+    if (*s == ')' || *s == '}') { depth--; }
+    if (depth > IVAL_NESTING) { return ival_err("Input nested more than %i deep.", IVAL_NESTING); }
   }
-  if (v->type == IVAL_SEXPR) { return ival_eval_sexpr(e, v); }
-  return v;
+  return NULL;
 }
 
-/* Reading */
-
 ival* ival_read_num(mpc_ast_t* t) {
   errno = 0;
   long x = strtol(t->contents, NULL, 10);
   return errno != ERANGE ? ival_num(x) : ival_err("Invalid Number.");
 }
 
-ival* ival_read(mpc_ast_t* t) {
+ival* ival_read_node(mpc_ast_t* t) {
   
   if (strstr(t->tag, "number")) { return ival_read_num(t); }
   if (strstr(t->tag, "symbol")) { return ival_sym(t->contents); }
@@ -450,15 +1288,42 @@ ival* ival_read(mpc_ast_t* t) {
   if (strcmp(t->tag, ">") == 0) { x = ival_sexpr(); } 
   if (strstr(t->tag, "sexpr"))  { x = ival_sexpr(); }
   if (strstr(t->tag, "qexpr"))  { x = ival_qexpr(); }
-  
-  for (int i = 0; i < t->children_num; i++) {
-    if (strcmp(t->children[i]->contents, "(") == 0) { continue; }
-    if (strcmp(t->children[i]->contents, ")") == 0) { continue; }
-    if (strcmp(t->children[i]->contents, "}") == 0) { continue; }
-    if (strcmp(t->children[i]->contents, "{") == 0) { continue; }
-    if (strcmp(t->children[i]->tag,  "regex") == 0) { continue; }
-    x = ival_add(x, ival_read(t->children[i]));
-  }
-  
   return x;
 }
+
+int ival_read_skip(mpc_ast_t* t) {
+  if (strcmp(t->contents, "(") == 0) { return 1; }
+  if (strcmp(t->contents, ")") == 0) { return 1; }
+  if (strcmp(t->contents, "}") == 0) { return 1; }
+  if (strcmp(t->contents, "{") == 0) { return 1; }
+  if (strcmp(t->tag,  "regex") == 0) { return 1; }
+  return 0;
+}
+
+ival* ival_read(mpc_ast_t* t) {
+
+  ival* root = ival_read_node(t);
+
+  /* Pairs of (node, list) where the list is still to be filled from the node */
+  iwork w;
+  iwork_init(&w);
+  iwork_push(&w, t);
+  iwork_push(&w, root);
+
+  while (w.count) {
+    ival* x = iwork_pop(&w);
+    t = iwork_pop(&w);
+    if (!x || (x->type != IVAL_SEXPR && x->type != IVAL_QEXPR)) { continue; }
+
+    for (int i = 0; i < t->children_num; i++) {
+      if (ival_read_skip(t->children[i])) { continue; }
+      ival* y = ival_read_node(t->children[i]);
+      x = ival_add(x, y);
+      iwork_push(&w, t->children[i]);
+      iwork_push(&w, y);
+    }
+  }
+
+  iwork_free(&w);
+  return root;
+}
@@ -5,44 +5,215 @@
 
 struct ival;
 struct ienv;
+struct ichunk;
+struct imemo;
+struct iseq;
+struct ifuture;
+struct ireact;
+struct iquote;
 typedef struct ival ival;
 typedef struct ienv ienv;
 
-enum { IVAL_ERR, IVAL_NUM, IVAL_SYM, IVAL_FUN, IVAL_SEXPR, IVAL_QEXPR };
+enum { IVAL_ERR, IVAL_NUM, IVAL_SYM, IVAL_FUN, IVAL_SEXPR, IVAL_QEXPR, IVAL_LAMBDA, IVAL_MEMO, IVAL_SEQ, IVAL_FUTURE };
 
 typedef ival*(*ibuiltin)(ienv*, ival*);
 
+/* Most arguments an error's message can have */
+#define IERROR_ARGS 4
+
+/*
+** An error as raised, with its message left unformatted until printed. The
+** format says what went wrong, and each argument is a number or the offset
+** of a string copied in after, so the whole is a single allocation.
+*/
+typedef struct ierror {
+  char* fmt;
+  int nargs;
+  char kinds[IERROR_ARGS];   /* 's' for a string, 'l' for a long, else an int */
+  long args[IERROR_ARGS];
+  int length;
+  char text[];
+} ierror;
+
+/* A lambda's code and the values it closed over, shared by every copy of it */
+typedef struct ilambda {
+  int refs;
+
+  /* As written, for printing */
+  ival* formals;
+  ival* body;
+
+  /* Names of the frame's slots: parameters, then captured values */
+  ival* locals;
+  int nparams;
+  int variadic;   /* The last parameter takes any extra arguments, from "&" */
+
+  int ncaptured;
+  ival** captured;
+
+  /* Body compiled the first time it is called */
+  struct ichunk* chunk;
+} ilambda;
+
 struct ival {
   int type;
 
-  long num;
+  /* What a value holds, only the one its type says is ever set */
+  union {
+    long num;
 
-  /* Error and Symbol types have some string data */
-  char* err;
-  char* sym;
-  ibuiltin fun;
+    /* Error and Symbol types have some string data */
+    ierror* err;
+    char* sym;
+    ibuiltin fun;
+    ilambda* lambda;
+    struct imemo* memo;
+    struct iseq* seq;
+    struct ifuture* future;
+  };
 
-  /* Count and Pointer to a list of "ival*" */
+  /* Count and Pointer to a list of "ival*", and its holders. Once shared it can't be changed, see ival_own */
   int count;
+  int refs;
   struct ival** cell;
 
+  /* What a shared Q-Expression compiled to when run by eval, see vm.h */
+  struct iquote* quote;
+
 };
 
 struct ienv {
   int count;
   char** syms;
   ival** vals;
+
+  /* How top level definitions were made, when reactive, see react.h */
+  struct ireact* react;
+
+  /* Counts definitions replacing another, so code compiled against the bindings before can tell */
+  int redefs;
 };
 
+/* Set while other threads may hold values too, see par.h */
+extern int ival_threaded;
+
+/*
+** Changes to reference counts, which must be atomic while values are shared
+** between threads. Otherwise they are left plain, costing nothing.
+*/
+#ifdef __GNUC__
+#define IREF_INC(r) (ival_threaded ? __atomic_add_fetch(&(r), 1, __ATOMIC_RELAXED) : ++(r))
+#define IREF_DEC(r) (ival_threaded ? __atomic_sub_fetch(&(r), 1, __ATOMIC_ACQ_REL) : --(r))
+#define IREF_GET(r) (ival_threaded ? __atomic_load_n(&(r), __ATOMIC_ACQUIRE) : (r))
+#else
+#define IREF_INC(r) (++(r))
+#define IREF_DEC(r) (--(r))
+#define IREF_GET(r) (r)
+#endif
+
+/* Explicit stacks for walking trees without recursion */
+typedef struct iwork {
+  int count;
+  int cap;
+  void** items;
+  void* local[32];
+} iwork;
+
+void iwork_init(iwork* w);
+void iwork_push(iwork* w, void* x);
+void* iwork_pop(iwork* w);
+void iwork_free(iwork* w);
+
 ienv* ienv_new(void);
 void ienv_del(ienv* e);
 void ienv_add_builtins(ienv* e);
+int ienv_slot(ienv* e, ival* k);
+ival* ienv_get(ienv* e, ival* k);
+void ienv_put(ienv* e, ival* k, ival* v);
 ival* ival_eval(ienv* e, ival* v);
 ival* ival_read(mpc_ast_t* t);
+void ival_print(ival* v);
 void ival_println(ival* v);
 void ival_del(ival* v);
 void ienv_del(ienv* e);
+/* Storage for a value, which each thread keeps a few of to hand rather than going back to malloc */
+ival* ival_alloc(void);
+void ival_free(ival* v);
+
+/* Give back what this thread has kept to hand, before it exits */
+void ival_spares_free(void);
+
 ival* ival_num(long x);
+ival* ival_err(char* fmt, ...);
+ival* ival_sym(char* s);
+ival* ival_fun(ibuiltin func);
+ival* ival_lambda(ival* formals, ival* body);
+ival* ival_sexpr(void);
+ival* ival_qexpr(void);
+ival* ival_copy(ival* v);
+ival* ival_share(ival* v);
+ival* ival_own(ival* v);
+ival* ival_unshare(ival* v);
+ival* ival_memo(struct imemo* m);
+ival* ival_seq(struct iseq* s);
+ival* ival_future(struct ifuture* f);
+int ival_truthy(ival* v);
+int ival_callable(ival* v);
+ival* ival_add(ival* v, ival* x);
+ival* ival_pop(ival* v, int i);
+ival* ival_take(ival* v, int i);
 ival* ival_read_num(mpc_ast_t* t);
+/* An error if a line is nested too deeply to be parsed, otherwise NULL */
+ival* ival_read_depth(char* s);
+char* ltype_name(int t);
+
+ival* builtin_list(ienv* e, ival* a);
+ival* builtin_head(ienv* e, ival* a);
+ival* builtin_tail(ienv* e, ival* a);
+ival* builtin_eval(ienv* e, ival* a);
+ival* builtin_eval_expr(ival* a);
+ival* builtin_join(ienv* e, ival* a);
+ival* builtin_add(ienv* e, ival* a);
+ival* builtin_sub(ienv* e, ival* a);
+ival* builtin_mul(ienv* e, ival* a);
+ival* builtin_div(ienv* e, ival* a);
+ival* builtin_def(ienv* e, ival* a);
+ival* builtin_lambda(ienv* e, ival* a);
+ival* builtin_if(ienv* e, ival* a);
+ival* builtin_and(ienv* e, ival* a);
+ival* builtin_or(ienv* e, ival* a);
+ival* builtin_range(ienv* e, ival* a);
+ival* builtin_iterate(ienv* e, ival* a);
+ival* builtin_map(ienv* e, ival* a);
+ival* builtin_filter(ienv* e, ival* a);
+ival* builtin_fold(ienv* e, ival* a);
+ival* builtin_reduce(ienv* e, ival* a);
+ival* builtin_pmap(ienv* e, ival* a);
+ival* builtin_preduce(ienv* e, ival* a);
+ival* builtin_spawn(ienv* e, ival* a);
+ival* builtin_await(ienv* e, ival* a);
+ival* builtin_pipe(ienv* e, ival* a);
+ival* builtin_memo(ienv* e, ival* a);
+ival* builtin_memo_stats(ienv* e, ival* a);
+ival* builtin_dotimes(ienv* e, ival* a);
+ival* builtin_stop(ienv* e, ival* a);
+
+/* Check the arguments to dotimes, returning its body as a lambda of the count and the value, how many times to run it and the first value */
+ival* builtin_dotimes_lambda(ival* a, long* count, ival** start);
+
+/* Whether the body of a loop gave stop to end it early */
+int ival_stops(ival* x);
+
+/* Arithmetic wraps around on overflow however it is run, rather than being undefined */
+#define IARITH_WRAP(x, op, y) ((long)((unsigned long)(x) op (unsigned long)(y)))
+
+/* The same with their arguments already known to be of the right types, see ibuiltin_unchecked */
+ival* builtin_head_unchecked(ienv* e, ival* a);
+ival* builtin_tail_unchecked(ienv* e, ival* a);
+ival* builtin_join_unchecked(ienv* e, ival* a);
+ival* builtin_add_unchecked(ienv* e, ival* a);
+ival* builtin_sub_unchecked(ienv* e, ival* a);
+ival* builtin_mul_unchecked(ienv* e, ival* a);
+ival* builtin_div_unchecked(ienv* e, ival* a);
 
 #endif
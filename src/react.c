@@ -0,0 +1,210 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include "../lib/mpc.h"
+#include "parse.h"
+#include "opt.h"
+#include "memo.h"
+#include "vm.h"
+#include "react.h"
+
+void ireact_start(ienv* e) {
+  if (e->react) { return; }
+  ireact* r = malloc(sizeof(ireact));
+  r->count = 0;
+  r->recipes = NULL;
+  r->busy = 0;
+  r->edits = 0;
+  r->ran = 0;
+  r->skipped = 0;
+  e->react = r;
+}
+
+static void irecipe_del(irecipe* p) {
+  if (!p) { return; }
+  ival_del(p->expr);
+  free(p->reads);
+  free(p);
+}
+
+void ireact_del(ireact* r) {
+  for (int i = 0; i < r->count; i++) { irecipe_del(r->recipes[i]); }
+  free(r->recipes);
+  free(r);
+}
+
+/* Make room for a recipe for every slot there is */
+static void ireact_grow(ireact* r, int n) {
+  if (n <= r->count) { return; }
+  r->recipes = realloc(r->recipes, sizeof(irecipe*) * n);
+  for (int i = r->count; i < n; i++) { r->recipes[i] = NULL; }
+  r->count = n;
+}
+
+/* Make a recipe's value again, noting down afresh what it reads */
+static ival* ireact_run(ienv* e, irecipe* p) {
+  iwork w;
+  iwork_init(&w);
+  iwork* was = ivm_record(&w);
+  ival* x = ival_eval(e, ival_copy(p->expr));
+  ivm_record(was);
+
+  /* Anything recording around this depends on the same reads */
+  char* seen = calloc(e->count + 1, 1);
+  free(p->reads);
+  p->reads = malloc(sizeof(int) * (w.count + 1));
+  p->nreads = 0;
+  for (int i = 0; i < w.count; i++) {
+    int s = (int)(intptr_t)w.items[i];
+    if (seen[s]) { continue; }
+    seen[s] = 1;
+    p->reads[p->nreads++] = s;
+    if (was) { iwork_push(was, w.items[i]); }
+  }
+  free(seen);
+  iwork_free(&w);
+  return x;
+}
+
+/* Slots with recipes, each after every other one it reads. Where they read each other in a loop, one is picked to go first */
+static int* ireact_order(ireact* r, int* count) {
+  int* order = malloc(sizeof(int) * (r->count + 1));
+  char* state = calloc(r->count + 1, 1);
+  *count = 0;
+
+  /* Pairs of a slot and the index of the next of its reads to follow */
+  iwork w;
+  iwork_init(&w);
+  for (int i = 0; i < r->count; i++) {
+    if (!r->recipes[i] || state[i]) { continue; }
+    state[i] = 1;
+    iwork_push(&w, (void*)(intptr_t)i);
+    iwork_push(&w, (void*)0);
+
+    while (w.count) {
+      int j = (int)(intptr_t)iwork_pop(&w);
+      int s = (int)(intptr_t)iwork_pop(&w);
+      irecipe* p = r->recipes[s];
+      if (j == p->nreads) {
+        order[(*count)++] = s;
+        continue;
+      }
+
+      iwork_push(&w, (void*)(intptr_t)s);
+      iwork_push(&w, (void*)(intptr_t)(j + 1));
+      int t = p->reads[j];
+      if (t < r->count && r->recipes[t] && !state[t]) {
+        state[t] = 1;
+        iwork_push(&w, (void*)(intptr_t)t);
+        iwork_push(&w, (void*)0);
+      }
+    }
+  }
+
+  iwork_free(&w);
+  free(state);
+  return order;
+}
+
+void ireact_changed(ienv* e, ival* syms) {
+  ireact* r = e->react;
+  if (!r || r->busy) { return; }
+  ireact_grow(r, e->count);
+
+  /* Whatever these were made from before, they have been given their values directly now */
+  int n = e->count;
+  char* changed = calloc(n, 1);
+  for (int i = 0; i < syms->count; i++) {
+    int s = ienv_slot(e, syms->cell[i]);
+    irecipe_del(r->recipes[s]);
+    r->recipes[s] = NULL;
+    changed[s] = 1;
+  }
+
+  r->busy = 1;
+  int count;
+  int* order = ireact_order(r, &count);
+  long ran = 0;
+  for (int k = 0; k < count; k++) {
+    int s = order[k];
+    irecipe* p = r->recipes[s];
+    int dirty = 0;
+    for (int j = 0; j < p->nreads && !dirty; j++) { dirty = p->reads[j] < n && changed[p->reads[j]]; }
+    if (!dirty) { continue; }
+
+    ival* x = ireact_run(e, p);
+    ran++;
+    if (ival_same(x, e->vals[s])) {
+      ival_del(x);
+      continue;
+    }
+    ival_del(e->vals[s]);
+    e->vals[s] = x;
+    IREF_INC(e->redefs);
+    changed[s] = 1;
+  }
+
+  /* Against running every definition again, as the whole script would, for changes anything depended on */
+  if (ran) {
+    r->edits++;
+    r->ran += ran;
+    r->skipped += count - ran;
+  }
+  r->busy = 0;
+  free(order);
+  free(changed);
+}
+
+/* Whether an expression is a def that can be taken apart, with a symbol for each value */
+static int ireact_form(ienv* e, ival* v) {
+  if (v->type != IVAL_SEXPR || v->count < 3 || v->cell[0]->type != IVAL_SYM) { return 0; }
+  if (ienv_builtin(e, v->cell[0]) != builtin_def) { return 0; }
+  ival* syms = v->cell[1];
+  if (syms->type != IVAL_QEXPR || syms->count != v->count - 2) { return 0; }
+  for (int i = 0; i < syms->count; i++) {
+    if (syms->cell[i]->type != IVAL_SYM) { return 0; }
+  }
+  return 1;
+}
+
+ival* ireact_eval(ienv* e, ival* v) {
+  if (!e->react || !ireact_form(e, v)) { return ival_eval(e, v); }
+
+  /* Each value is made on its own, so its symbol depends on just what it reads */
+  int n = v->count - 2;
+  irecipe** made = malloc(sizeof(irecipe*) * n);
+  ival* a = ival_sexpr();
+  ival_add(a, ival_copy(v->cell[1]));
+  ival* err = NULL;
+  for (int i = 0; i < n; i++) {
+    irecipe* p = malloc(sizeof(irecipe));
+    p->expr = ival_copy(v->cell[i+2]);
+    p->reads = NULL;
+    p->nreads = 0;
+    made[i] = p;
+    ival* x = ireact_run(e, p);
+    if (x->type == IVAL_ERR && !err) { err = ival_copy(x); }
+    ival_add(a, x);
+  }
+
+  /* The first error wins, as it would for any call */
+  ival* x = err;
+  if (err) { ival_del(a); } else { x = builtin_def(e, a); }
+
+  /* One made from its own old value, such as x from x + 1, is an update rather than something to redo */
+  ireact* r = e->react;
+  ireact_grow(r, e->count);
+  for (int i = 0; i < n; i++) {
+    int s = ienv_slot(e, v->cell[1]->cell[i]);
+    int own = 0;
+    for (int j = 0; j < made[i]->nreads; j++) { own = own || made[i]->reads[j] == s; }
+    if (x->type == IVAL_ERR || s < 0 || own) {
+      irecipe_del(made[i]);
+      continue;
+    }
+    irecipe_del(r->recipes[s]);
+    r->recipes[s] = made[i];
+  }
+  free(made);
+  ival_del(v);
+  return x;
+}
@@ -0,0 +1,47 @@
+#ifndef IGOR_REACT
+#define IGOR_REACT
+
+#include "parse.h"
+
+/*
+** Reactive definitions. Each top level def in a reactive environment keeps the
+** expressions its values came from and the globals they read along the way.
+** Redefining a symbol then recomputes just the definitions depending on it,
+** each after those it reads, rather than the whole script being run again. A
+** definition coming out the same as before doesn't pass the change on.
+*/
+
+/* How a symbol's value was made */
+typedef struct irecipe {
+  ival* expr;
+
+  /* Slots of the globals read, each once */
+  int nreads;
+  int* reads;
+} irecipe;
+
+typedef struct ireact {
+  /* By slot, NULL for symbols given their value any other way */
+  int count;
+  irecipe** recipes;
+
+  /* Set while recomputing, when definitions made along the way don't cascade */
+  int busy;
+
+  /* Redefinitions something depended on, and the definitions recomputed or left alone for them */
+  long edits;
+  long ran;
+  long skipped;
+} ireact;
+
+/* Make an environment reactive */
+void ireact_start(ienv* e);
+void ireact_del(ireact* r);
+
+/* Evaluate a top level expression, keeping how it was made if it is a def */
+ival* ireact_eval(ienv* e, ival* v);
+
+/* Recompute whatever depends on symbols just redefined */
+void ireact_changed(ienv* e, ival* syms);
+
+#endif
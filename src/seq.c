@@ -0,0 +1,556 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include "../lib/mpc.h"
+#include "parse.h"
+#include "vm.h"
+#include "par.h"
+#include "seq.h"
+
+/* Sequences */
+
+static iseq* iseq_new(int kind) {
+  iseq* s = malloc(sizeof(iseq));
+  s->refs = 1;
+  s->kind = kind;
+  s->at = 0;
+  s->end = 0;
+  s->step = 1;
+  s->x = NULL;
+  s->fn = NULL;
+  s->parts = NULL;
+  s->source = NULL;
+  s->stages = NULL;
+  return s;
+}
+
+iseq* iseq_range(long at, long end, long step) {
+  iseq* s = iseq_new(ISEQ_RANGE);
+  s->at = at;
+  s->end = end;
+  s->step = step;
+  return s;
+}
+
+iseq* iseq_iterate(ival* fn, ival* x) {
+  iseq* s = iseq_new(ISEQ_ITERATE);
+  s->fn = fn;
+  s->x = x;
+  return s;
+}
+
+static int ival_empty(ival* v) {
+  return v->type == IVAL_SEQ ? iseq_empty(v->seq) : v->count == 0;
+}
+
+iseq* iseq_join(ival* a) {
+  iseq* s = iseq_new(ISEQ_JOIN);
+  s->parts = ival_qexpr();
+
+  /* Joins inside are flattened, so stepping never has to look more than one part deep */
+  for (int i = 0; i < a->count; i++) {
+    ival* p = a->cell[i];
+    if (p->type == IVAL_SEQ && p->seq->kind == ISEQ_JOIN) {
+      ival* q = p->seq->parts;
+      for (int j = 0; j < q->count; j++) { ival_add(s->parts, ival_share(q->cell[j])); }
+      ival_del(p);
+    } else if (ival_empty(p)) {
+      ival_del(p);
+    } else {
+      ival_add(s->parts, p);
+    }
+  }
+
+  free(a->cell);
+  ival_free(a);
+  return s;
+}
+
+void iseq_release(iseq* s) {
+  if (IREF_DEC(s->refs) > 0) { return; }
+  if (s->x) { ival_del(s->x); }
+  if (s->fn) { ival_del(s->fn); }
+  if (s->parts) { ival_del(s->parts); }
+  if (s->source) { ival_del(s->source); }
+  if (s->stages) { ival_del(s->stages); }
+  free(s);
+}
+
+iseq* iseq_own(iseq* s) {
+  if (IREF_GET(s->refs) == 1) { return s; }
+
+  iseq* x = iseq_new(s->kind);
+  x->at = s->at;
+  x->end = s->end;
+  x->step = s->step;
+  if (s->x) { x->x = ival_copy(s->x); }
+  if (s->fn) { x->fn = ival_copy(s->fn); }
+  if (s->parts) { x->parts = ival_share(s->parts); }
+  if (s->source) { x->source = ival_copy(s->source); }
+  if (s->stages) { x->stages = ival_share(s->stages); }
+
+  /* Let go only once copied, in case another holder lets go at the same time and leaves it to us */
+  iseq_release(s);
+  return x;
+}
+
+/* Elements left in a non-empty range, counted without overflowing */
+static unsigned long iseq_left(iseq* s) {
+  unsigned long gap = s->step > 0
+    ? (unsigned long)s->end - (unsigned long)s->at
+    : (unsigned long)s->at - (unsigned long)s->end;
+  unsigned long stride = s->step > 0 ? (unsigned long)s->step : -(unsigned long)s->step;
+  return (gap - 1) / stride + 1;
+}
+
+int iseq_empty(iseq* s) {
+  switch (s->kind) {
+    case ISEQ_RANGE: return s->step > 0 ? s->at >= s->end : s->at <= s->end;
+    case ISEQ_JOIN: return s->parts->count == 0;
+    case ISEQ_PIPE: return s->x == NULL;
+    default: return 0;
+  }
+}
+
+ival* iseq_first(iseq* s) {
+  if (iseq_empty(s)) { return NULL; }
+  switch (s->kind) {
+    case ISEQ_RANGE: return ival_num(s->at);
+    case ISEQ_ITERATE:
+    case ISEQ_PIPE: return ival_copy(s->x);
+    default: {
+      ival* p = s->parts->cell[0];
+      return p->type == IVAL_SEQ ? iseq_first(p->seq) : ival_copy(p->cell[0]);
+    }
+  }
+}
+
+static ival* iseq_fill(ienv* e, iseq* s);
+
+ival* iseq_next(ienv* e, iseq* s) {
+  if (iseq_empty(s)) { return NULL; }
+  switch (s->kind) {
+
+    /* Stop at the end rather than stepping past it, which could overflow */
+    case ISEQ_RANGE:
+      if (iseq_left(s) == 1) { s->at = s->end; } else { s->at += s->step; }
+    return NULL;
+
+    /* The function runs on each value as it is stepped past */
+    case ISEQ_ITERATE: {
+      ival* args[] = { ival_copy(s->fn), s->x };
+      s->x = ivm_call(e, args, 2);
+      return s->x->type == IVAL_ERR ? ival_copy(s->x) : NULL;
+    }
+
+    case ISEQ_PIPE:
+      ival_del(s->x);
+      s->x = NULL;
+    return iseq_fill(e, s);
+
+    default: {
+      s->parts = ival_own(s->parts);
+      ival* p = s->parts->cell[0];
+      ival* err = NULL;
+      if (p->type == IVAL_SEQ) {
+        p->seq = iseq_own(p->seq);
+        err = iseq_next(e, p->seq);
+      } else {
+        p = s->parts->cell[0] = ival_own(p);
+        ival_del(ival_pop(p, 0));
+      }
+      if (ival_empty(p)) { ival_del(ival_pop(s->parts, 0)); }
+      return err;
+    }
+  }
+}
+
+/* Pipelines */
+
+/*
+** Run a value through the first "limit" maps and filters of a chain. Gives
+** what comes out, NULL when a filter drops it, or an error with *at set to
+** the stage it came from.
+*/
+static ival* ipipe_through(ienv* e, ival* stages, int limit, ival* x, int* at) {
+  for (int j = 0; j < limit; j++) {
+    ival* f = stages->cell[2*j+1];
+    if (stages->cell[2*j]->num == IPIPE_MAP) {
+      ival* args[] = { ival_copy(f), x };
+      x = ivm_call(e, args, 2);
+      if (x->type == IVAL_ERR) {
+        *at = j;
+        return x;
+      }
+      continue;
+    }
+
+    ival* args[] = { ival_copy(f), ival_share(x) };
+    ival* keep = ivm_call(e, args, 2);
+    if (keep->type == IVAL_ERR) {
+      ival_del(x);
+      *at = j;
+      return keep;
+    }
+    int t = ival_truthy(keep);
+    ival_del(keep);
+    if (!t) {
+      ival_del(x);
+      return NULL;
+    }
+  }
+  return x;
+}
+
+/* Step a pipe's source until a value comes out of the far end, or it runs out */
+static ival* iseq_fill(ienv* e, iseq* s) {
+  while (!s->x) {
+    ival* err = ival_interrupted();
+    if (err) { return err; }
+    iseq* source = s->source->seq = iseq_own(s->source->seq);
+    ival* x = iseq_first(source);
+    if (!x) { return NULL; }
+    err = iseq_next(e, source);
+    if (err) {
+      ival_del(x);
+      return err;
+    }
+
+    int at;
+    s->x = ipipe_through(e, s->stages, s->stages->count / 2, x, &at);
+    if (s->x && s->x->type == IVAL_ERR) {
+      err = s->x;
+      s->x = NULL;
+      return err;
+    }
+  }
+  return NULL;
+}
+
+ival* iseq_pipe(ienv* e, ival* stages, int sink, ival* fn, ival* init, ival* xs) {
+
+  /* A map or filter at the end is just one more stage */
+  if (sink == IPIPE_MAP || sink == IPIPE_FILTER) {
+    ival_add(stages, ival_num(sink));
+    ival_add(stages, fn);
+    fn = NULL;
+  }
+
+  /*
+  ** Sequences never make lists in between anyway, so each stage steps through
+  ** the one before on its own, failing just when it would called separately
+  */
+  if (xs->type == IVAL_SEQ) {
+    for (int j = 0; j < stages->count; j += 2) {
+      iseq* s = iseq_new(ISEQ_PIPE);
+      s->source = xs;
+      s->stages = ival_qexpr();
+      ival_add(s->stages, ival_share(stages->cell[j]));
+      ival_add(s->stages, ival_share(stages->cell[j+1]));
+      ival* err = iseq_fill(e, s);
+      if (err) {
+        iseq_release(s);
+        ival_del(stages);
+        if (fn) { ival_del(fn); }
+        if (init) { ival_del(init); }
+        return err;
+      }
+      xs = ival_seq(s);
+    }
+    ival_del(stages);
+    if (!fn) { return xs; }
+    stages = ival_qexpr();
+  }
+
+  /* Elements come from a sequence one at a time, or straight out of a list we own */
+  iseq* s = NULL;
+  ival* list = NULL;
+  if (xs->type == IVAL_SEQ) {
+    s = xs->seq;
+    IREF_INC(s->refs);
+    ival_del(xs);
+    s = iseq_own(s);
+  } else {
+    list = ival_own(xs);
+  }
+
+  /*
+  ** Once a stage fails it and those after it stop, but those before carry on
+  ** in case one fails too. A sequence is stepped through lazily, so its first
+  ** failure is the result.
+  */
+  int limit = stages->count / 2;
+  ival* err = NULL;
+  ival* out = fn ? NULL : ival_qexpr();
+  ival* acc = init;
+  int i = 0;
+
+  while (!(err && s)) {
+    /* Interrupted, the rest is just thrown away */
+    if (!err && (err = ival_interrupted())) { limit = 0; }
+    if (err && s) { break; }
+
+    ival* x;
+    if (s) {
+      x = iseq_first(s);
+      if (!x) { break; }
+      err = iseq_next(e, s);
+      if (err) {
+        ival_del(x);
+        break;
+      }
+    } else {
+      if (i == list->count) { break; }
+      x = list->cell[i++];
+    }
+
+    int at;
+    ival* y = ipipe_through(e, stages, limit, x, &at);
+    if (!y) { continue; }
+    if (y->type == IVAL_ERR) {
+      if (err) { ival_del(err); }
+      err = y;
+      limit = at;
+      continue;
+    }
+    if (err) {
+      ival_del(y);
+      continue;
+    }
+
+    if (out) {
+      ival_add(out, y);
+      continue;
+    }
+    if (sink == IPIPE_REDUCE && !acc) {
+      acc = y;
+      continue;
+    }
+    ival* args[] = { ival_copy(fn), acc, y };
+    acc = ivm_call(e, args, 3);
+    if (acc->type == IVAL_ERR) {
+      err = acc;
+      acc = NULL;
+    }
+  }
+
+  if (s) { iseq_release(s); }
+  if (list) {
+    for (; i < list->count; i++) { ival_del(list->cell[i]); }
+    free(list->cell);
+    ival_free(list);
+  }
+  ival_del(stages);
+  if (fn) { ival_del(fn); }
+
+  if (err) {
+    if (out) { ival_del(out); }
+    if (acc) { ival_del(acc); }
+    return err;
+  }
+  if (out) { return out; }
+  if (!acc) { return ival_err("Function 'reduce' passed {} for argument 1."); }
+  return acc;
+}
+
+/* Data Parallelism */
+
+/* Slices made for each thread when no grain is given, so that uneven ones even out */
+#define ISEQ_SLICES 4
+
+/*
+** A run of elements of a list owned by the caller, each replaced by what it maps
+** to in place or all reduced to acc, by whichever thread takes it. Stops at the
+** first error, leaving the rest NULL.
+*/
+typedef struct islice {
+  itask task;
+  ienv* e;
+  int sink;
+  ival* fn;
+  ival** cell;
+  int count;
+  ival* acc;
+  ival* err;
+} islice;
+
+static void islice_run(itask* t) {
+  islice* s = (islice*)t;
+  ival** c = s->cell;
+  int i = 0;
+
+  if (s->sink == IPIPE_MAP) {
+    for (; i < s->count; i++) {
+      ival* args[] = { ival_copy(s->fn), c[i] };
+      c[i] = ivm_call(s->e, args, 2);
+      if (c[i]->type == IVAL_ERR) {
+        s->err = c[i];
+        c[i++] = NULL;
+        break;
+      }
+    }
+  } else {
+    s->acc = c[i];
+    c[i++] = NULL;
+    for (; i < s->count; i++) {
+      ival* args[] = { ival_copy(s->fn), s->acc, c[i] };
+      s->acc = ivm_call(s->e, args, 3);
+      c[i] = NULL;
+      if (s->acc->type == IVAL_ERR) {
+        s->err = s->acc;
+        s->acc = NULL;
+        i++;
+        break;
+      }
+    }
+  }
+
+  for (; i < s->count; i++) {
+    ival_del(c[i]);
+    c[i] = NULL;
+  }
+}
+
+ival* iseq_par(ienv* e, int sink, ival* fn, ival* xs, long grain) {
+  long n = xs->type == IVAL_QEXPR ? xs->count : 0;
+  if (grain <= 0) {
+    long k = (long)ipool_threads * ISEQ_SLICES;
+    grain = (n + k - 1) / k;
+  }
+  long count = grain > 0 ? (n + grain - 1) / grain : 0;
+
+  /* Nothing to split it between, or pinned to this thread, so the same as the one thread version */
+  if (ipool_threads == 1 || count < 2 || ivm_pinned()) { return iseq_pipe(e, ival_qexpr(), sink, fn, NULL, xs); }
+
+  ival* list = ival_own(xs);
+  islice* slices = malloc(sizeof(islice) * count);
+  itask** tasks = malloc(sizeof(itask*) * count);
+  for (long k = 0; k < count; k++) {
+    islice* s = &slices[k];
+    s->task.run = islice_run;
+    s->e = e;
+    s->sink = sink;
+    s->fn = fn;
+    s->cell = list->cell + k * grain;
+    s->count = k == count-1 ? n - k * grain : grain;
+    s->acc = NULL;
+    s->err = NULL;
+    tasks[k] = &s->task;
+  }
+  ipool_run(tasks, count);
+  free(tasks);
+
+  /* The slices hold the lowest error first, as one thread going in order would have stopped at */
+  ival* err = NULL;
+  for (long k = 0; k < count; k++) {
+    if (!err) { err = slices[k].err; } else if (slices[k].err) { ival_del(slices[k].err); }
+  }
+
+  /* Mapped elements are already in order in the list, and reduced slices are joined up in order */
+  ival* acc = NULL;
+  for (long k = 0; k < count && sink == IPIPE_REDUCE; k++) {
+    ival* x = slices[k].acc;
+    if (!x) { continue; }
+    if (err || !acc) {
+      if (err) { ival_del(x); } else { acc = x; }
+      continue;
+    }
+    ival* args[] = { ival_copy(fn), acc, x };
+    acc = ivm_call(e, args, 3);
+    if (acc->type == IVAL_ERR) {
+      err = acc;
+      acc = NULL;
+    }
+  }
+  free(slices);
+  ival_del(fn);
+
+  if (sink == IPIPE_REDUCE || err) {
+    for (long i = 0; i < n; i++) { if (list->cell[i]) { ival_del(list->cell[i]); } }
+    free(list->cell);
+    ival_free(list);
+    return err ? err : acc;
+  }
+  return list;
+}
+
+/* Elements are handed to the builtin this many at a time, after the running result */
+#define ISEQ_BATCH 64
+
+/* Elements of a range reduced without making them between checks for interrupts */
+#define ISEQ_STRETCH (1 << 20)
+
+ival* iseq_reduce(ienv* e, ival* v, ibuiltin f) {
+  iseq* s = v->seq;
+  IREF_INC(s->refs);
+  ival_del(v);
+  s = iseq_own(s);
+
+  /* Ranges of plain numbers need no values made at all */
+  if (s->kind == ISEQ_RANGE && !iseq_empty(s)
+      && (f == builtin_add || f == builtin_sub || f == builtin_mul || f == builtin_div)) {
+    unsigned long n = iseq_left(s);
+    long x = s->at;
+    long step = s->step;
+    long r = x;
+    iseq_release(s);
+
+    if (f == builtin_sub && n == 1) { r = IARITH_WRAP(0, -, r); }
+
+    /* Long ranges take a while even so, so are done a stretch at a time between checks for interrupts */
+    for (unsigned long i = 1; i < n;) {
+      ival* err = ival_interrupted();
+      if (err) { return err; }
+      unsigned long end = n - i > ISEQ_STRETCH ? i + ISEQ_STRETCH : n;
+      if (f == builtin_add) { for (; i < end; i++) { x += step; r = IARITH_WRAP(r, +, x); } }
+      if (f == builtin_sub) { for (; i < end; i++) { x += step; r = IARITH_WRAP(r, -, x); } }
+      if (f == builtin_mul) { for (; i < end; i++) { x += step; r = IARITH_WRAP(r, *, x); } }
+      if (f == builtin_div) {
+        for (; i < end; i++) {
+          x += step;
+          if (x == 0) { return ival_err("Division By Zero."); }
+          if (x == -1 && r == LONG_MIN) { return ival_err("Integer Overflow."); }
+          r /= x;
+        }
+      }
+    }
+    return ival_num(r);
+  }
+
+  /* Otherwise the builtin runs over a batch at a time, so each element is checked as it would be in a list */
+  ival* r = NULL;
+  while (1) {
+    ival* err = ival_interrupted();
+    if (err) {
+      if (r) { ival_del(r); }
+      iseq_release(s);
+      return err;
+    }
+
+    ival* a = ival_sexpr();
+    if (r) { ival_add(a, r); }
+
+    int fresh = 0;
+    for (; fresh < ISEQ_BATCH; fresh++) {
+      ival* x = iseq_first(s);
+      if (!x) { break; }
+      ival_add(a, x);
+      err = iseq_next(e, s);
+      if (err) {
+        ival_del(a);
+        iseq_release(s);
+        return err;
+      }
+    }
+
+    if (r && fresh == 0) {
+      r = ival_take(a, 0);
+      break;
+    }
+    r = f(e, a);
+    if (r->type == IVAL_ERR || fresh < ISEQ_BATCH) { break; }
+  }
+
+  iseq_release(s);
+  return r;
+}
@@ -0,0 +1,81 @@
+#ifndef IGOR_SEQ
+#define IGOR_SEQ
+
+#include "parse.h"
+
+enum { ISEQ_RANGE, ISEQ_ITERATE, ISEQ_JOIN, ISEQ_PIPE };
+
+/* What each stage of a pipeline does with the values reaching it */
+enum { IPIPE_MAP, IPIPE_FILTER, IPIPE_FOLD, IPIPE_REDUCE };
+
+/*
+** A sequence whose elements are only made as they are reached. Values holding
+** one share it, and anything stepping through it first takes its own copy
+** unless it is the only holder.
+*/
+typedef struct iseq {
+  int refs;
+  int kind;
+
+  /* Ranges count from at by step, stopping before end */
+  long at;
+  long end;
+  long step;
+
+  /* Iterations hold their next value and the function giving the one after */
+  ival* x;
+  ival* fn;
+
+  /* Joins hold what is left of each part in order, never empty ones nor other joins */
+  ival* parts;
+
+  /* Pipes hold the sequence they draw from and their maps and filters, with x the next value out */
+  ival* source;
+  ival* stages;
+} iseq;
+
+iseq* iseq_range(long at, long end, long step);
+iseq* iseq_iterate(ival* fn, ival* x);
+
+/* Lazily join an S-Expression of Q-Expressions and sequences, taking ownership of it */
+iseq* iseq_join(ival* a);
+
+void iseq_release(iseq* s);
+
+/* Trade a reference for a sequence only the caller holds, ready to be stepped through */
+iseq* iseq_own(iseq* s);
+
+int iseq_empty(iseq* s);
+
+/* A copy of the first element, or NULL at the end */
+ival* iseq_first(iseq* s);
+
+/* Step past the first element, returning NULL or an error from making the next */
+ival* iseq_next(ienv* e, iseq* s);
+
+/*
+** Run every element of a Q-Expression or sequence through a chain of maps and
+** filters, a Q-Expression of kinds and functions innermost first, and then a
+** sink: another map or filter, or a fold from init, or a reduce. All in one
+** pass, taking ownership of everything. Maps and filters of a sequence give a
+** sequence doing the same as it is stepped through.
+**
+** Errors come out as though each stage ran over the whole list in turn, the
+** innermost stage to fail winning, though functions may run in another order.
+*/
+ival* iseq_pipe(ienv* e, ival* stages, int sink, ival* fn, ival* init, ival* xs);
+
+/*
+** A map or reduce of a Q-Expression split into slices of "grain" elements, or
+** a few for each thread given 0, which run on the pool. Mapped values are put
+** back in order in place of the elements, and a reduce joins up the results
+** of each slice in order, so it only matches one going from the left for
+** functions which are associative. Sequences, and anything with no pool to
+** run on, are mapped or reduced as they would be by iseq_pipe.
+*/
+ival* iseq_par(ienv* e, int sink, ival* fn, ival* xs, long grain);
+
+/* Apply an arithmetic builtin to every element of a sequence value in turn, in constant memory, consuming it */
+ival* iseq_reduce(ienv* e, ival* v, ibuiltin f);
+
+#endif
@@ -0,0 +1,1418 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include "../lib/mpc.h"
+#include "parse.h"
+#include "opt.h"
+#include "jit.h"
+#include "memo.h"
+#include "par.h"
+#include "vm.h"
+
+/* Chunks */
+
+ichunk* ichunk_new(void) {
+  ichunk* c = malloc(sizeof(ichunk));
+  c->count = 0;
+  c->code = NULL;
+  c->nconsts = 0;
+  c->consts = NULL;
+  c->slots = NULL;
+  c->depth = 0;
+  c->once = 0;
+  c->shared = 0;
+  c->refs = 1;
+  c->threaded = NULL;
+  c->narith = 0;
+  c->ariths = NULL;
+  c->npar = 0;
+  c->pars = NULL;
+  return c;
+}
+
+static void ipar_del(ipar* p) {
+  for (int i = 0; i < p->count; i++) {
+    ival_del(p->exprs[i]);
+    if (p->chunks[i]) { ichunk_del(p->chunks[i]); }
+  }
+  free(p->exprs);
+  free(p->heavy);
+  free(p->chunks);
+  free(p);
+}
+
+void ichunk_del(ichunk* c) {
+  if (IREF_DEC(c->refs) > 0) { return; }
+  for (int i = 0; i < c->nconsts; i++) {
+    if (c->consts[i]) { ival_del(c->consts[i]); }
+  }
+  free(c->consts);
+  free(c->slots);
+  for (int i = 0; i < c->narith; i++) {
+    iarith_del(c->ariths[i]);
+  }
+  free(c->ariths);
+  for (int i = 0; i < c->npar; i++) {
+    ipar_del(c->pars[i]);
+  }
+  free(c->pars);
+  free(c->code);
+  free(c->threaded);
+  free(c);
+}
+
+/* Arrays grow by doubling whenever their count reaches a power of two */
+static int ichunk_full(int n) { return n >= 4 && (n & (n - 1)) == 0; }
+
+void ichunk_emit(ichunk* c, int x) {
+  if (c->count == 0) { c->code = malloc(sizeof(int) * 4); }
+  if (ichunk_full(c->count)) { c->code = realloc(c->code, sizeof(int) * c->count * 2); }
+  c->count++;
+  c->code[c->count-1] = x;
+}
+
+int ichunk_const(ichunk* c, ival* v) {
+  if (c->nconsts == 0) {
+    c->consts = malloc(sizeof(ival*) * 4);
+    c->slots = malloc(sizeof(int) * 4);
+  }
+  if (ichunk_full(c->nconsts)) {
+    c->consts = realloc(c->consts, sizeof(ival*) * c->nconsts * 2);
+    c->slots = realloc(c->slots, sizeof(int) * c->nconsts * 2);
+  }
+  c->nconsts++;
+  c->consts[c->nconsts-1] = v;
+  c->slots[c->nconsts-1] = -1;
+  return c->nconsts-1;
+}
+
+/* Compilation */
+
+/* The arithmetic operator a builtin implements, or -1 */
+static int iarith_of(ibuiltin f) {
+  if (f == builtin_add) { return IARITH_ADD; }
+  if (f == builtin_sub) { return IARITH_SUB; }
+  if (f == builtin_mul) { return IARITH_MUL; }
+  if (f == builtin_div) { return IARITH_DIV; }
+  return -1;
+}
+
+/* The operator of an S-Expression applying arithmetic to at least one argument, or -1 */
+static int iarith_node(ienv* e, ival* locals, ival* v) {
+  if (v->type != IVAL_SEXPR || v->count < 2 || v->cell[0]->type != IVAL_SYM) { return -1; }
+  return iarith_of(iscope_builtin(e, locals, v->cell[0]));
+}
+
+/* Translate a tree of arithmetic over numbers and symbols to postfix, or NULL if it is anything else */
+iarith* ival_arith(ienv* e, ival* locals, ival* v) {
+  int op = iarith_node(e, locals, v);
+  if (op < 0) { return NULL; }
+
+  iarith* a = iarith_new(e);
+
+  /* Triples of (operator node, its operator, index of its next child) */
+  iwork w;
+  iwork_init(&w);
+  iwork_push(&w, v);
+  iwork_push(&w, (void*)(intptr_t)op);
+  iwork_push(&w, (void*)1);
+
+  while (w.count) {
+    int i = (int)(intptr_t)iwork_pop(&w);
+    op = (int)(intptr_t)iwork_pop(&w);
+    v = iwork_pop(&w);
+
+    /* Each child after the second combines with the running value */
+    if (i > 2) { iarith_emit(a, op, 0); }
+    if (i == v->count) {
+      if (v->count == 2 && op == IARITH_SUB) { iarith_emit(a, IARITH_NEG, 0); }
+      int slot = ienv_slot(e, v->cell[0]);
+      iarith_op(a, slot, e->vals[slot]->fun);
+      continue;
+    }
+
+    iwork_push(&w, v);
+    iwork_push(&w, (void*)(intptr_t)op);
+    iwork_push(&w, (void*)(intptr_t)(i + 1));
+
+    ival* x = v->cell[i];
+    if (x->type == IVAL_NUM) { iarith_emit(a, IARITH_NUM, x->num); continue; }
+    if (x->type == IVAL_SYM && !iscope_builtin(e, locals, x)) {
+      iarith_emit(a, IARITH_SYM, iarith_sym(a, x, iscope_slot(locals, x)));
+      continue;
+    }
+
+    int xop = iarith_node(e, locals, x);
+    if (xop >= 0) {
+      iwork_push(&w, x);
+      iwork_push(&w, (void*)(intptr_t)xop);
+      iwork_push(&w, (void*)1);
+      continue;
+    }
+
+    iwork_free(&w);
+    iarith_del(a);
+    return NULL;
+  }
+
+  iwork_free(&w);
+  iarith_fuse(a);
+  return a;
+}
+
+/*
+** Keep a copy of the arguments of a call if at least two of them are costly,
+** to be run on other threads while there are any free. Returns its index in
+** the chunk, or -1.
+*/
+static int ichunk_par(ichunk* c, ienv* e, ival* locals, ival* v) {
+  int n = v->count - 1;
+  int* heavy = malloc(sizeof(int) * (n > 0 ? n : 1));
+  int costly = 0;
+  for (int i = 0; i < n; i++) { costly += heavy[i] = ival_heavy(e, locals, v->cell[i+1]); }
+  if (costly < 2) {
+    free(heavy);
+    return -1;
+  }
+
+  ipar* p = malloc(sizeof(ipar));
+  p->count = n;
+  p->exprs = malloc(sizeof(ival*) * n);
+  p->heavy = heavy;
+  p->chunks = calloc(n, sizeof(ichunk*));
+  for (int i = 0; i < n; i++) { p->exprs[i] = ival_copy(v->cell[i+1]); }
+
+  c->npar++;
+  c->pars = realloc(c->pars, sizeof(ipar*) * c->npar);
+  c->pars[c->npar-1] = p;
+  return c->npar-1;
+}
+
+const int iop_operands[] = { 1, 1, 1, 1, 3, 2, 2, 2, 1, 1, 1, 2, 0 };
+
+int ibail_enabled = 1;
+
+/*
+** Compiler work items, ITASK_PLAIN being an expression inside an arithmetic
+** tree. Special forms emit their branch instructions between their parts, and
+** at the end fill in where they go, as do calls with arguments to fork or that
+** may fail.
+*/
+enum { ITASK_EXPR, ITASK_PLAIN, ITASK_CALL, ITASK_CALLB, ITASK_SKIP,
+  ITASK_TEST, ITASK_ELSE, ITASK_AND, ITASK_OR, ITASK_END, ITASK_FORK, ITASK_JOIN, ITASK_BAIL };
+
+/* Whether evaluating an expression could give an error, locals never being one */
+static int ival_failable(ival* locals, ival* v) {
+  if (v->type == IVAL_SYM) { return iscope_slot(locals, v) < 0; }
+  return v->type == IVAL_SEXPR || v->type == IVAL_ERR;
+}
+
+/* A call has been emitted, each argument bailing out of it goes to just after, back to the mark made for it */
+static void ichunk_land(ichunk* c, iwork* bails) {
+  while (1) {
+    int at = (int)(intptr_t)iwork_pop(bails);
+    if (at < 0) { return; }
+    c->code[at] = c->count;
+  }
+}
+
+/* Queue up the parts of a special form, or return 0 to compile it as a call */
+static int ichunk_form(ichunk* c, iwork* w, ival* v, ibuiltin f, int sp) {
+  int n = v->count - 1;
+  if (f == builtin_if && n != 2 && n != 3) { return 0; }
+
+  /* Nothing to decide between */
+  if (f != builtin_if && n < 2) {
+    ival* x = n ? v->cell[1] : ival_num(f == builtin_and);
+    ival_del(v->cell[0]);
+    free(v->cell);
+    ival_free(v);
+    iwork_push(w, x);
+    iwork_push(w, (void*)(intptr_t)sp);
+    iwork_push(w, (void*)ITASK_EXPR);
+    return 1;
+  }
+
+  /* The end has to fill in one place for each jump made to it, and knows nothing of the value left */
+  iwork_push(w, (void*)(intptr_t)sp);
+  iwork_push(w, v);
+  iwork_push(w, (void*)(intptr_t)(f == builtin_if ? 2 : n - 1));
+  iwork_push(w, (void*)ITASK_END);
+
+  /* An if without an else gives an empty expression when false */
+  if (f == builtin_if) {
+    iwork_push(w, n == 3 ? v->cell[3] : ival_sexpr());
+    iwork_push(w, (void*)(intptr_t)sp);
+    iwork_push(w, (void*)ITASK_EXPR);
+    iwork_push(w, NULL);
+    iwork_push(w, (void*)(intptr_t)sp);
+    iwork_push(w, (void*)ITASK_ELSE);
+    iwork_push(w, v->cell[2]);
+    iwork_push(w, (void*)(intptr_t)sp);
+    iwork_push(w, (void*)ITASK_EXPR);
+    iwork_push(w, NULL);
+    iwork_push(w, (void*)(intptr_t)sp);
+    iwork_push(w, (void*)ITASK_TEST);
+    iwork_push(w, v->cell[1]);
+    iwork_push(w, (void*)(intptr_t)sp);
+    iwork_push(w, (void*)ITASK_EXPR);
+    return 1;
+  }
+
+  for (int i = n; i >= 1; i--) {
+    iwork_push(w, v->cell[i]);
+    iwork_push(w, (void*)(intptr_t)sp);
+    iwork_push(w, (void*)ITASK_EXPR);
+    if (i == 1) { break; }
+    iwork_push(w, NULL);
+    iwork_push(w, (void*)(intptr_t)sp);
+    iwork_push(w, (void*)(intptr_t)(f == builtin_and ? ITASK_AND : ITASK_OR));
+  }
+  return 1;
+}
+
+/* A jump straight to a return may as well return, which lets calls before it be tail calls */
+static void ichunk_peephole(ichunk* c) {
+  for (int i = 0; i < c->count; i += 1 + iop_operands[c->code[i]]) {
+    if (c->code[i] == IOP_JUMP && c->code[c->code[i+1]] == IOP_RET) {
+      c->code[i] = IOP_RET;
+      c->code[i+1] = IOP_RET;
+    }
+  }
+}
+
+ichunk* ival_compile(ienv* e, ival* v) {
+  return ival_compile_in(e, NULL, ival_fold(e, NULL, v));
+}
+
+/* Note what the value an expression leaves at a depth of the stack is proven to be */
+static void iproven_set(int** proven, int* count, int at, int type) {
+  if (at >= *count) {
+    *count = (at + 1) * 2;
+    *proven = realloc(*proven, sizeof(int) * *count);
+  }
+  (*proven)[at] = type;
+}
+
+ichunk* ival_compile_in(ienv* e, ival* locals, ival* v) {
+  ichunk* c = ichunk_new();
+  v = ival_unshare(v);
+
+  /*
+  ** Triples of (expression, stack depth before it, task), so deep input can't
+  ** recurse. The end of a special form has its depth beneath.
+  */
+  iwork w;
+  iwork_init(&w);
+  iwork_push(&w, v);
+  iwork_push(&w, (void*)0);
+  iwork_push(&w, (void*)ITASK_EXPR);
+
+  /* Operands of the branches of the special forms being compiled, to be filled in when their target is */
+  iwork jumps;
+  iwork_init(&jumps);
+
+  /* Likewise operands of arguments' bail outs, each call's above a mark of -1 */
+  iwork bails;
+  iwork_init(&bails);
+
+  /* By depth, the type of the value last compiled to be left there, or -1 if it could be anything */
+  int* proven = NULL;
+  int nproven = 0;
+
+  while (w.count) {
+    int task = (int)(intptr_t)iwork_pop(&w);
+    int sp = (int)(intptr_t)iwork_pop(&w);
+    v = iwork_pop(&w);
+
+    /* The fallback code for an arithmetic tree is done, fill in how far to skip it */
+    if (task == ITASK_SKIP) {
+      int at = (int)(intptr_t)v;
+      c->code[at] = c->count - (at + 1);
+      continue;
+    }
+
+    /* The condition of an if is on the stack, the true branch follows */
+    if (task == ITASK_TEST) {
+      ichunk_emit(c, IOP_TEST);
+      ichunk_emit(c, 0);
+      ichunk_emit(c, 0);
+      iwork_push(&jumps, (void*)(intptr_t)(c->count-1));
+      iwork_push(&jumps, (void*)(intptr_t)(c->count-2));
+      continue;
+    }
+
+    /* The true branch is done, skip the false one which starts here */
+    if (task == ITASK_ELSE) {
+      ichunk_emit(c, IOP_JUMP);
+      ichunk_emit(c, 0);
+      int at = (int)(intptr_t)iwork_pop(&jumps);
+      c->code[at] = c->count;
+      iwork_push(&jumps, (void*)(intptr_t)(c->count-1));
+      continue;
+    }
+
+    /* One argument of an and or an or is on the stack, which may be the result */
+    if (task == ITASK_AND || task == ITASK_OR) {
+      ichunk_emit(c, task == ITASK_AND ? IOP_AND : IOP_OR);
+      ichunk_emit(c, 0);
+      iwork_push(&jumps, (void*)(intptr_t)(c->count-1));
+      continue;
+    }
+
+    /* A special form is done, its jumps come here */
+    if (task == ITASK_END) {
+      for (int i = 0; i < sp; i++) {
+        int at = (int)(intptr_t)iwork_pop(&jumps);
+        c->code[at] = c->count;
+      }
+      iproven_set(&proven, &nproven, (int)(intptr_t)iwork_pop(&w), -1);
+      ival_del(v->cell[0]);
+      free(v->cell);
+      ival_free(v);
+      continue;
+    }
+
+    /* The function of a call is on the stack, its arguments may be evaluated all at once */
+    if (task == ITASK_FORK) {
+      ichunk_emit(c, IOP_PAR);
+      ichunk_emit(c, (int)(intptr_t)v);
+      ichunk_emit(c, 0);
+      iwork_push(&jumps, (void*)(intptr_t)(c->count-1));
+      continue;
+    }
+
+    /* An argument is on the stack, if it failed the rest are skipped along with the call */
+    if (task == ITASK_BAIL) {
+      ichunk_emit(c, IOP_BAIL);
+      ichunk_emit(c, (int)(intptr_t)v);
+      ichunk_emit(c, 0);
+      iwork_push(&bails, (void*)(intptr_t)(c->count-1));
+      continue;
+    }
+
+    /* Or else they have just been evaluated in turn */
+    if (task == ITASK_JOIN) {
+      int at = (int)(intptr_t)iwork_pop(&jumps);
+      c->code[at] = c->count;
+      continue;
+    }
+
+    /* All children of an S-Expression have been pushed, apply them */
+    if (task == ITASK_CALL) {
+      iproven_set(&proven, &nproven, sp, -1);
+      ichunk_emit(c, IOP_CALL);
+      ichunk_emit(c, v->count);
+      ichunk_land(c, &bails);
+      free(v->cell);
+      ival_free(v);
+      continue;
+    }
+
+    /* Likewise but calling a builtin directly, keeping its symbol in case it is redefined */
+    if (task == ITASK_CALLB) {
+      ibuiltin f = iscope_builtin(e, locals, v->cell[0]);
+      int type;
+      ibuiltin entry = ibuiltin_unchecked(f, proven + sp + 1, v->count-1, &type);
+      ichunk_emit(c, IOP_CALLB);
+      ichunk_emit(c, ienv_slot(e, v->cell[0]));
+      ichunk_emit(c, ichunk_const(c, v->cell[0]));
+      ichunk_const(c, ival_fun(f));
+      ichunk_const(c, ival_fun(entry));
+      ichunk_emit(c, v->count-1);
+      ichunk_land(c, &bails);
+      iproven_set(&proven, &nproven, sp, type);
+      free(v->cell);
+      ival_free(v);
+      continue;
+    }
+
+    if (sp + 1 > c->depth) { c->depth = sp + 1; }
+
+    switch (v->type) {
+
+      /* Locals are known now, anything else is looked up when executed */
+      case IVAL_SYM: {
+        iproven_set(&proven, &nproven, sp, -1);
+        int k = iscope_slot(locals, v);
+        if (k >= 0) {
+          ichunk_emit(c, IOP_LOCAL);
+          ichunk_emit(c, k);
+          ival_del(v);
+          break;
+        }
+        ichunk_emit(c, IOP_GLOBAL);
+        ichunk_emit(c, ichunk_const(c, v));
+      }
+      break;
+
+      /* Push each child in turn then apply them */
+      case IVAL_SEXPR: {
+        /* Chains of maps and filters run as one */
+        v = ival_fuse(e, locals, v);
+
+        /* Builtins are resolved now, apart from eval, lambda and dotimes which the VM runs itself */
+        ibuiltin f = NULL;
+        if (v->count > 0 && v->cell[0]->type == IVAL_SYM) {
+          ibuiltin form = iscope_form(e, locals, v->cell[0]);
+          if (form && ichunk_form(c, &w, v, form, sp)) { break; }
+          f = iscope_builtin(e, locals, v->cell[0]);
+        }
+        int direct = v->count > 1 && f && f != builtin_eval && f != builtin_lambda && f != builtin_dotimes;
+
+        /* Pure arithmetic may run natively once hot, skipping the code that follows */
+        iarith* a = task == ITASK_PLAIN ? NULL : ival_arith(e, locals, v);
+        if (a) {
+          c->narith++;
+          c->ariths = realloc(c->ariths, sizeof(iarith*) * c->narith);
+          c->ariths[c->narith-1] = a;
+          ichunk_emit(c, IOP_ARITH);
+          ichunk_emit(c, c->narith-1);
+          ichunk_emit(c, 0);
+          iwork_push(&w, (void*)(intptr_t)(c->count-1));
+          iwork_push(&w, (void*)(intptr_t)sp);
+          iwork_push(&w, (void*)ITASK_SKIP);
+        }
+
+        /* Likewise costly arguments may run on other threads, while there are any */
+        int par = !a && task != ITASK_PLAIN && ipool_threads > 1 ? ichunk_par(c, e, locals, v) : -1;
+
+        iwork_push(&w, v);
+        iwork_push(&w, (void*)(intptr_t)sp);
+        iwork_push(&w, (void*)(intptr_t)(direct ? ITASK_CALLB : ITASK_CALL));
+        iwork_push(&bails, (void*)-1);
+        if (par >= 0) {
+          iwork_push(&w, NULL);
+          iwork_push(&w, (void*)(intptr_t)sp);
+          iwork_push(&w, (void*)ITASK_JOIN);
+        }
+        for (int i = v->count-1; i >= direct; i--) {
+          /* Once one fails the call will too, so the rest needn't run, dropping those evaluated before */
+          if (ibail_enabled && i < v->count-1 && ival_failable(locals, v->cell[i])) {
+            iwork_push(&w, (void*)(intptr_t)(i - direct));
+            iwork_push(&w, (void*)(intptr_t)sp);
+            iwork_push(&w, (void*)ITASK_BAIL);
+          }
+          iwork_push(&w, v->cell[i]);
+          iwork_push(&w, (void*)(intptr_t)(sp + i));
+          iwork_push(&w, (void*)(intptr_t)(a || task == ITASK_PLAIN ? ITASK_PLAIN : ITASK_EXPR));
+          if (i == 1 && par >= 0) {
+            iwork_push(&w, (void*)(intptr_t)par);
+            iwork_push(&w, (void*)(intptr_t)sp);
+            iwork_push(&w, (void*)ITASK_FORK);
+          }
+        }
+      }
+      break;
+
+      /* Everything else evaluates to itself */
+      default:
+        iproven_set(&proven, &nproven, sp, v->type);
+        ichunk_emit(c, IOP_CONST);
+        ichunk_emit(c, ichunk_const(c, v));
+      break;
+    }
+  }
+
+  iwork_free(&w);
+  iwork_free(&jumps);
+  iwork_free(&bails);
+  free(proven);
+  ichunk_emit(c, IOP_RET);
+  ichunk_peephole(c);
+  return c;
+}
+
+/* Execution */
+
+/* The first error among "n" values with all the others deleted, or NULL if there is none */
+ival* ivm_first_err(ival** args, int n) {
+  for (int i = 0; i < n; i++) {
+    if (args[i]->type == IVAL_ERR) {
+      for (int j = 0; j < n; j++) { if (j != i) { ival_del(args[j]); } }
+      return args[i];
+    }
+  }
+  return NULL;
+}
+
+/* Gather "n" values into a fresh S-Expression to hand to a builtin */
+ival* ivm_args(ival** args, int n) {
+  ival* a = ival_sexpr();
+  a->count = n;
+  a->cell = malloc(sizeof(ival*) * n);
+  memcpy(a->cell, args, sizeof(ival*) * n);
+  return a;
+}
+
+/* Quoted Code */
+
+void iquote_del(iquote* q) {
+  ichunk_del(q->chunk);
+  if (q->locals) { ival_del(q->locals); }
+  free(q);
+}
+
+/*
+** The chunk eval runs for a Q-Expression held elsewhere as well, compiled the
+** first time and kept on it, giving a reference to it. One kept for some other
+** environment or frame, or from before a redefinition, is left alone, and the
+** chunk made instead only run once.
+*/
+static ichunk* iquote_chunk(ienv* e, ival* locals, ival* v) {
+  iquote* q = ILAZY_GET(v->quote);
+  int redefs = IREF_GET(e->redefs);
+  if (q && q->env == e && q->redefs == redefs
+      && (q->locals && locals ? ival_same(q->locals, locals) : q->locals == locals)) {
+    IREF_INC(q->chunk->refs);
+    return q->chunk;
+  }
+
+  ival* x = ival_copy(v);
+  x->type = IVAL_SEXPR;
+  ichunk* c = ival_compile_in(e, locals, ival_fold(e, locals, x));
+  c->once = 1;
+  if (q) { return c; }
+
+  q = malloc(sizeof(iquote));
+  q->chunk = c;
+  q->env = e;
+  q->redefs = redefs;
+  q->locals = locals ? ival_copy(locals) : NULL;
+  iquote* none = NULL;
+  if (!ILAZY_SET(v->quote, none, q)) {
+    if (q->locals) { ival_del(q->locals); }
+    free(q);
+    return c;
+  }
+  c->once = 0;
+  c->shared = 1;
+  IREF_INC(c->refs);
+  return c;
+}
+
+/* Lambdas */
+
+/* A lambda's body runs as eval would run it, against the lambda's frame. It is compiled on the first call, on whichever thread makes it first */
+static ichunk* ilambda_chunk(ienv* e, ilambda* l) {
+  ichunk* c = ILAZY_GET(l->chunk);
+  if (c) { return c; }
+
+  ival* body = ival_copy(l->body);
+  body->type = IVAL_SEXPR;
+  c = ival_compile_in(e, l->locals, body);
+  ichunk* none = NULL;
+  if (ILAZY_SET(l->chunk, none, c)) { return c; }
+  ichunk_del(c);
+  return none;
+}
+
+/* Bind "n" arguments in place, gathering any past the "&" into a Q-Expression. Returns -1 on a bad count */
+static int ilambda_bind(ilambda* l, ival** args, int n) {
+  if (!l->variadic) { return n == l->nparams ? n : -1; }
+
+  int fixed = l->nparams - 1;
+  if (n < fixed) { return -1; }
+  args[fixed] = ivm_args(args + fixed, n - fixed);
+  args[fixed]->type = IVAL_QEXPR;
+  return l->nparams;
+}
+
+/* Copy in the values of any locals of the enclosing frame which the body mentions */
+static void ilambda_capture(ilambda* l, ival* scope, ival** frame) {
+  iwork w;
+  iwork_init(&w);
+  iwork_push(&w, l->body);
+
+  while (w.count) {
+    ival* v = iwork_pop(&w);
+    if (v->type == IVAL_SYM) {
+      int k = iscope_slot(scope, v);
+      if (k >= 0 && iscope_slot(l->locals, v) < 0) {
+        ival_add(l->locals, ival_copy(v));
+        l->ncaptured++;
+        l->captured = realloc(l->captured, sizeof(ival*) * l->ncaptured);
+        l->captured[l->ncaptured-1] = ival_copy(frame[k]);
+      }
+    }
+    if (v->type == IVAL_SEXPR || v->type == IVAL_QEXPR) {
+      for (int i = 0; i < v->count; i++) { iwork_push(&w, v->cell[i]); }
+    }
+  }
+
+  iwork_free(&w);
+}
+
+/* Free the parameters of a lambda's frame and then the function below them, which may own fn */
+static void ivm_release(ival** stack, int base, ilambda* fn) {
+  int n = fn->nparams;
+  for (int i = 0; i < n; i++) { ival_del(stack[base + i]); }
+  ival_del(stack[base - 1]);
+}
+
+static ival* ivm_exec(ienv* e, ichunk* c, ival** args, int n, ilambda* in, irun* r);
+
+/* Lambdas called from C start out in a chunk that just returns their result */
+static int ivm_ret_code[] = { IOP_RET };
+static ichunk ivm_ret = { .count = 1, .code = ivm_ret_code };
+
+/* Apply "n" evaluated values the same way an S-Expression is, consuming them */
+ival* ivm_call(ienv* e, ival** args, int n) {
+
+  /* The first error wins, everything else is thrown away */
+  ival* err = ivm_first_err(args, n);
+  if (err) { return err; }
+
+  if (n == 0) { return ival_sexpr(); }
+  if (n == 1) { return args[0]; }
+
+  ival* f = args[0];
+
+  /* Memos call through to their function when they miss */
+  if (f->type == IVAL_MEMO) {
+    imemo_entry* p;
+    ival* x = imemo_get(f->memo, args + 1, n-1, &p);
+    if (x) {
+      for (int i = 0; i < n; i++) { ival_del(args[i]); }
+      return x;
+    }
+    args[0] = ival_copy(p->memo->fn);
+    ival_del(f);
+    x = ivm_call(e, args, n);
+    imemo_fill(p, x);
+    return x;
+  }
+
+  if (f->type == IVAL_LAMBDA) { return ivm_exec(e, &ivm_ret, args, n, NULL, NULL); }
+
+  /* Ensure first element is a function */
+  if (f->type != IVAL_FUN) {
+    ival* err = ival_err(
+      "S-Expression starts with incorrect type. Got %s, Expected %s.",
+      ltype_name(f->type), ltype_name(IVAL_FUN));
+    for (int i = 0; i < n; i++) { ival_del(args[i]); }
+    return err;
+  }
+
+  ival* result = f->fun(e, ivm_args(args + 1, n-1));
+  ival_del(f);
+  return result;
+}
+
+/*
+** Dispatch. With GCC or Clang every opcode is replaced by the address of its
+** handler the first time a chunk runs, and each handler jumps straight to the
+** next one. Elsewhere, or with IGOR_NO_THREADING defined, a plain switch is used.
+*/
+
+#if defined(__GNUC__) && !defined(IGOR_NO_THREADING)
+#define IVM_THREADED
+#endif
+
+#ifdef IVM_THREADED
+
+/* Chunks may be shared between threads, which could both get to threading one first */
+static void** ichunk_thread(ichunk* c, void** labels) {
+  void** t = ILAZY_GET(c->threaded);
+  if (t) { return t; }
+
+  t = malloc(sizeof(void*) * c->count);
+  for (int i = 0; i < c->count;) {
+    int op = c->code[i];
+    t[i++] = labels[op];
+    for (int j = 0; j < iop_operands[op]; j++, i++) { t[i] = (void*)(intptr_t)c->code[i]; }
+  }
+  void** none = NULL;
+  if (ILAZY_SET(c->threaded, none, t)) { return t; }
+  free(t);
+  return none;
+}
+
+typedef void** ivm_pc;
+
+#define VM_START   goto **pc++;
+#define VM_END
+#define VM_CASE(op) L_##op:
+#define VM_NEXT    goto **pc++
+#define VM_ARG     ((int)(intptr_t)*pc++)
+#define VM_AT(op)  (*pc == labels[op])
+#define VM_JUMP(at) pc = c->threaded + (at)
+#define VM_OFFSET  ((int)(pc - c->threaded))
+
+#else
+
+typedef int* ivm_pc;
+
+#define VM_START   while (1) { switch (*pc++) {
+#define VM_END     } }
+#define VM_CASE(op) case op:
+#define VM_NEXT    continue
+#define VM_ARG     (*pc++)
+#define VM_AT(op)  (*pc == op)
+#define VM_JUMP(at) pc = c->code + (at)
+#define VM_OFFSET  ((int)(pc - c->code))
+
+#endif
+
+/* An activation waiting on a call or an eval it made */
+typedef struct iframe {
+  ichunk* chunk;
+  ivm_pc pc;
+  int base;
+  ilambda* fn;
+  int call;
+  long loop;
+  imemo_entry* store;
+} iframe;
+
+/* Grow an array which may still be the buffer on the C stack it started out in */
+static void* ivm_grow(void* items, void* local, size_t size, int count, int cap) {
+  if (items != local) { return realloc(items, size * cap); }
+  void* x = malloc(size * cap);
+  memcpy(x, local, size * count);
+  return x;
+}
+
+/* Fuel */
+
+long ival_fuel = 0;
+
+/* Calls left on this thread before an evaluation runs out, and whether one is being metered at all */
+static ITHREAD long ivm_fuel = LONG_MAX;
+static ITHREAD int ivm_metering;
+
+/* Whether running out stops the outermost run to be resumed, rather than failing every call */
+static ITHREAD int ivm_slicing;
+
+/* Interrupts */
+
+/* Set from a signal handler, so only ever read and written whole */
+static int ivm_interrupt;
+
+void ival_interrupt(int on) { ICACHE_SET(ivm_interrupt, on); }
+
+ival* ival_interrupted(void) {
+  return ICACHE_GET(ivm_interrupt) ? ival_err("Evaluation interrupted.") : NULL;
+}
+
+/* A run stopped part way, holding the state of the VM to carry on from */
+struct irun {
+  ienv* e;
+  ichunk* top;
+  int abandon;
+
+  ival** stack;
+  int cap;
+  int sp;
+  iframe* frames;
+  int nframes;
+  int capframes;
+
+  ichunk* c;
+  int at;
+  int base;
+  ilambda* fn;
+  int call;
+  long loop;
+  imemo_entry* store;
+};
+
+/* Reads */
+
+/* Where to note the globals this thread reads, or NULL */
+static ITHREAD iwork* ivm_reads;
+
+iwork* ivm_record(iwork* reads) {
+  iwork* was = ivm_reads;
+  ivm_reads = reads;
+  return was;
+}
+
+int ivm_pinned(void) {
+  return ivm_metering || ivm_reads;
+}
+
+/* Parallel Arguments */
+
+/* How deeply arguments run on other threads may nest on one thread's own stack */
+#define IPAR_DEPTH 32
+
+static ITHREAD int ipar_depth;
+
+/* An argument of a call, evaluated by whichever thread takes it against the frame of the caller */
+typedef struct iargtask {
+  itask task;
+  ienv* e;
+  ipar* p;
+  int i;
+  ilambda* fn;
+  ival** frame;
+  ival** out;
+} iargtask;
+
+static void iargtask_run(itask* t) {
+  iargtask* a = (iargtask*)t;
+  ipar* p = a->p;
+
+  /* Compiled the first time it is run, in the scope of the call */
+  ichunk* c = ILAZY_GET(p->chunks[a->i]);
+  if (!c) {
+    c = ival_compile_in(a->e, a->fn ? a->fn->locals : NULL, ival_copy(p->exprs[a->i]));
+    ichunk* none = NULL;
+    if (!ILAZY_SET(p->chunks[a->i], none, c)) {
+      ichunk_del(c);
+      c = none;
+    }
+  }
+
+  ipar_depth++;
+  *a->out = ivm_exec(a->e, c, a->frame, a->fn ? a->fn->nparams + a->fn->ncaptured : 0, a->fn, NULL);
+  ipar_depth--;
+}
+
+/* Evaluate every argument of a call into out, the costly ones as tasks for the pool */
+static void ipar_run(ienv* e, ipar* p, ilambda* fn, ival** frame, ival** out) {
+  iargtask local[8];
+  itask* local_tasks[8];
+  iargtask* args = p->count > 8 ? malloc(sizeof(iargtask) * p->count) : local;
+  itask** tasks = p->count > 8 ? malloc(sizeof(itask*) * p->count) : local_tasks;
+
+  int n = 0;
+  for (int i = 0; i < p->count; i++) {
+    iargtask* a = &args[i];
+    a->task.run = iargtask_run;
+    a->e = e;
+    a->p = p;
+    a->i = i;
+    a->fn = fn;
+    a->frame = frame;
+    a->out = out + i;
+    if (p->heavy[i]) { tasks[n++] = &a->task; }
+  }
+
+  /* The cheap ones are done here while the others are taken */
+  ipool_run(tasks, n);
+  for (int i = 0; i < p->count; i++) {
+    if (!p->heavy[i]) { iargtask_run(&args[i].task); }
+  }
+
+  if (args != local) { free(args); }
+  if (tasks != local_tasks) { free(tasks); }
+}
+
+/*
+** Run a chunk, or when given "n" values first apply them as a call from within
+** it. Given a lambda as well, the values are the frame of a call to it, which
+** are only borrowed, and the chunk runs as part of its body. Given a run, it
+** carries on from wherever that stopped, and stops again at the next call once
+** out of fuel, giving NULL.
+*/
+static ival* ivm_exec(ienv* e, ichunk* c, ival** args, int n, ilambda* in, irun* r) {
+
+  #ifdef IVM_THREADED
+  static void* labels[] = { &&L_IOP_CONST, &&L_IOP_GLOBAL, &&L_IOP_LOCAL, &&L_IOP_CALL, &&L_IOP_CALLB,
+    &&L_IOP_ARITH, &&L_IOP_PAR, &&L_IOP_TEST, &&L_IOP_JUMP, &&L_IOP_AND, &&L_IOP_OR, &&L_IOP_BAIL, &&L_IOP_RET };
+  #define VM_ENTER(chunk) c = (chunk); pc = ichunk_thread(c, labels)
+  #else
+  #define VM_ENTER(chunk) c = (chunk); pc = c->code
+  #endif
+  ivm_pc pc;
+
+  /* One value stack shared by every frame, starting out on the C stack and moved to the heap to grow */
+  ival* local[64];
+  ival** stack = local;
+  int cap = 64;
+  int sp = 0;
+  #define VM_RESERVE(size, live) \
+    if ((size) > cap) { \
+      stack = ivm_grow(stack, local, sizeof(ival*), live, (size) * 2); \
+      cap = (size) * 2; \
+    }
+  VM_RESERVE(c->depth + n, 0);
+
+  /*
+  ** A lambda's frame sits on the value stack at base: its parameters, owned by
+  ** the call, then borrowed pointers to what it captured. The function itself
+  ** is just below, keeping them alive. An eval inside a lambda shares its frame.
+  */
+  int base = 0;
+  ilambda* fn = in;
+  int call = 0;
+
+  /* In the frame of a loop, how many times its body runs in all, the count so far being its first slot */
+  long loop = 0;
+
+  /* The memo entry waiting on the current call's result, and one for the call about to be made */
+  imemo_entry* store = NULL;
+  imemo_entry* pending = NULL;
+
+  iframe local_frames[16];
+  iframe* frames = local_frames;
+  int nframes = 0;
+  int capframes = 16;
+  #define VM_SAVE() \
+    if (nframes == capframes) { \
+      frames = ivm_grow(frames, local_frames, sizeof(iframe), nframes, capframes * 2); \
+      capframes *= 2; \
+    } \
+    frames[nframes].chunk = c; frames[nframes].pc = pc; frames[nframes].base = base; \
+    frames[nframes].fn = fn; frames[nframes].call = call; frames[nframes].loop = loop; \
+    frames[nframes].store = store; nframes++
+
+  /* Chunks made by eval only run once, and are ours to free unless we were given them, or let go of if kept */
+  ichunk* top = c;
+  #define VM_DONE() if (c != top && (c->once || c->shared)) { ichunk_del(c); }
+
+  VM_ENTER(c);
+
+  if (r && r->stack) {
+    stack = r->stack; cap = r->cap; sp = r->sp;
+    frames = r->frames; nframes = r->nframes; capframes = r->capframes;
+    base = r->base; fn = r->fn; call = r->call; loop = r->loop; store = r->store;
+    VM_ENTER(r->c);
+    pc += r->at;
+    r->stack = NULL;
+    r->frames = NULL;
+    if (r->abandon) { r = NULL; }
+  }
+
+  /* A run out of fuel stops before its next call, the instruction to be run again once resumed */
+  #define VM_YIELD() if (r && ivm_fuel <= 0) { pc--; goto yield; }
+
+  if (n) { memcpy(stack, args, sizeof(ival*) * n); }
+  if (in) { sp = n; }
+  else if (n) { goto apply; }
+
+  VM_START
+
+    VM_CASE(IOP_CONST) {
+      /* A chunk that only runs once can give its constants away */
+      int k = VM_ARG;
+      if (c->once) { stack[sp++] = c->consts[k]; c->consts[k] = NULL; }
+      else { stack[sp++] = ival_share(c->consts[k]); }
+    }
+    VM_NEXT;
+
+    VM_CASE(IOP_GLOBAL) {
+      /* Bindings never move once made, so a slot found before only needs its name checking */
+      int k = VM_ARG;
+      int s = ICACHE_GET(c->slots[k]);
+      if (s < 0 || s >= e->count || strcmp(e->syms[s], c->consts[k]->sym) != 0) {
+        s = ienv_slot(e, c->consts[k]);
+        ICACHE_SET(c->slots[k], s);
+      }
+      if (ivm_reads && s >= 0 && (!ivm_reads->count || ivm_reads->items[ivm_reads->count-1] != (void*)(intptr_t)s)) {
+        iwork_push(ivm_reads, (void*)(intptr_t)s);
+      }
+      stack[sp++] = s >= 0 ? ival_share(e->vals[s]) : ienv_get(e, c->consts[k]);
+    }
+    VM_NEXT;
+
+    VM_CASE(IOP_LOCAL)
+      stack[sp++] = ival_share(stack[base + VM_ARG]);
+    VM_NEXT;
+
+    VM_CASE(IOP_CALL)
+      VM_YIELD();
+      n = VM_ARG;
+      sp -= n;
+    apply: {
+      ival* f = stack[sp];
+
+      /* Out of fuel or interrupted every call fails, so the evaluation unwinds as it would from any error */
+      if ((--ivm_fuel < 0 && !ivm_slicing) || ICACHE_GET(ivm_interrupt)) {
+        for (int i = 0; i < n; i++) { ival_del(stack[sp + i]); }
+        stack[sp] = ICACHE_GET(ivm_interrupt) ? ival_interrupted()
+          : ival_err("Evaluation ran out of fuel after %li calls.", ival_fuel);
+        if (pending) { imemo_fill(pending, stack[sp]); pending = NULL; }
+        sp++;
+        VM_NEXT;
+      }
+
+      /* eval runs its expression in a new frame rather than recursing */
+      if (n > 1 && f->type == IVAL_FUN && f->fun == builtin_eval) {
+        ival* locals = fn ? fn->locals : NULL;
+        ichunk* body = NULL;
+        ival* x = ivm_first_err(stack + sp, n);
+        if (!x && n == 2 && stack[sp+1]->type == IVAL_QEXPR && IREF_GET(stack[sp+1]->refs) > 1) {
+          body = iquote_chunk(e, locals, stack[sp+1]);
+          ival_del(stack[sp+1]);
+          ival_del(f);
+        } else if (!x) {
+          x = builtin_eval_expr(ivm_args(stack + sp + 1, n-1));
+          ival_del(f);
+        }
+        if (body || x->type != IVAL_ERR) {
+          /* In tail position the current frame is finished with, so reuse it */
+          if (VM_AT(IOP_RET)) {
+            VM_DONE();
+          } else {
+            VM_SAVE();
+            call = 0;
+            loop = 0;
+            store = NULL;
+          }
+          if (!body) {
+            body = ival_compile_in(e, locals, ival_fold(e, locals, x));
+            body->once = 1;
+          }
+          VM_ENTER(body);
+          VM_RESERVE(sp + c->depth, sp);
+          VM_NEXT;
+        }
+        stack[sp++] = x;
+        VM_NEXT;
+      }
+
+      /* A lambda made inside another takes what it needs from the enclosing frame */
+      if (n > 1 && f->type == IVAL_FUN && f->fun == builtin_lambda) {
+        ival* x = ivm_call(e, stack + sp, n);
+        if (fn && x->type == IVAL_LAMBDA) { ilambda_capture(x->lambda, fn->locals, stack + base); }
+        stack[sp++] = x;
+        VM_NEXT;
+      }
+
+      /* A loop runs its body as a lambda of the count and the value, over and over in one frame, see IOP_RET */
+      if (n > 1 && f->type == IVAL_FUN && f->fun == builtin_dotimes) {
+        long count = 0;
+        ival* start = NULL;
+        ival* x = ivm_first_err(stack + sp, n);
+        if (!x) {
+          ival_del(f);
+          x = builtin_dotimes_lambda(ivm_args(stack + sp + 1, n-1), &count, &start);
+        }
+        if (x->type == IVAL_ERR || count <= 0) {
+          if (start) {
+            ival_del(x);
+            x = start;
+          }
+          stack[sp++] = x;
+          VM_NEXT;
+        }
+
+        ilambda* l = x->lambda;
+        if (fn) { ilambda_capture(l, fn->locals, stack + base); }
+        ichunk* body = ilambda_chunk(e, l);
+        VM_RESERVE(sp + 3 + l->ncaptured + body->depth, sp);
+        stack[sp] = x;
+        stack[sp+1] = ival_num(0);
+        stack[sp+2] = start;
+        VM_SAVE();
+        base = sp + 1;
+        fn = l;
+        call = 1;
+        loop = count;
+        store = NULL;
+        for (int i = 0; i < l->ncaptured; i++) { stack[base + l->nparams + i] = l->captured[i]; }
+        sp = base + l->nparams + l->ncaptured;
+        VM_ENTER(body);
+        VM_NEXT;
+      }
+
+      /* A memo missing on a lambda runs it here, filling in its entry once it returns */
+      if (n > 1 && f->type == IVAL_MEMO && f->memo->fn->type == IVAL_LAMBDA) {
+        ival* x = ivm_first_err(stack + sp, n);
+        if (!x) {
+          x = imemo_get(f->memo, stack + sp + 1, n-1, &pending);
+          if (x) { for (int i = 0; i < n; i++) { ival_del(stack[sp + i]); } }
+        }
+        if (x) {
+          stack[sp++] = x;
+          VM_NEXT;
+        }
+        stack[sp] = ival_copy(pending->memo->fn);
+        ival_del(f);
+        goto apply;
+      }
+
+      /* Calling a lambda binds its arguments where they already are on the stack */
+      if (n > 1 && f->type == IVAL_LAMBDA) {
+        ilambda* l = f->lambda;
+        ival* err = ivm_first_err(stack + sp, n);
+        ichunk* body = NULL;
+        if (!err) {
+          body = ilambda_chunk(e, l);
+          VM_RESERVE(sp + 1 + l->nparams + l->ncaptured + body->depth, sp + n);
+          if (ilambda_bind(l, stack + sp + 1, n-1) < 0) {
+            err = ival_err("Function passed incorrect number of arguments. Got %i, Expected %i.",
+              n-1, l->nparams - l->variadic);
+            for (int i = 0; i < n; i++) { ival_del(stack[sp + i]); }
+          }
+        }
+        if (err) {
+          if (pending) { imemo_fill(pending, err); pending = NULL; }
+          stack[sp++] = err;
+          VM_NEXT;
+        }
+
+        /* A call in tail position replaces the frame of the lambda making it, unless it has a result to store or is looping */
+        if (call && !store && !loop && VM_AT(IOP_RET)) {
+          VM_DONE();
+          ivm_release(stack, base, fn);
+          memmove(stack + base - 1, stack + sp, sizeof(ival*) * (l->nparams + 1));
+          sp = base - 1;
+        } else {
+          VM_SAVE();
+        }
+
+        base = sp + 1;
+        fn = l;
+        call = 1;
+        loop = 0;
+        store = pending;
+        pending = NULL;
+        for (int i = 0; i < l->ncaptured; i++) { stack[base + l->nparams + i] = l->captured[i]; }
+        sp = base + l->nparams + l->ncaptured;
+        VM_ENTER(body);
+        VM_NEXT;
+      }
+
+      stack[sp] = ivm_call(e, stack + sp, n);
+      sp++;
+    }
+    VM_NEXT;
+
+    VM_CASE(IOP_CALLB) {
+      VM_YIELD();
+      int slot = VM_ARG;
+      int k = VM_ARG;
+      n = VM_ARG;
+      sp -= n;
+
+      /* Still bound to the same builtin, so skip the lookup and the function value, and any checks the compiler proved needless. Out of fuel or interrupted, the call fails as any other would */
+      ibuiltin f = c->consts[k+1]->fun;
+      if (ivm_fuel > 0 && !ICACHE_GET(ivm_interrupt) && slot >= 0 && slot < e->count && e->vals[slot]->type == IVAL_FUN && e->vals[slot]->fun == f) {
+        ivm_fuel--;
+        ival* err = ivm_first_err(stack + sp, n);
+        stack[sp] = err ? err : c->consts[k+2]->fun(e, ivm_args(stack + sp, n));
+        sp++;
+        VM_NEXT;
+      }
+
+      /* Otherwise fall back to looking the symbol up like any other call */
+      memmove(stack + sp + 1, stack + sp, sizeof(ival*) * n);
+      stack[sp] = ienv_get(e, c->consts[k]);
+      n++;
+      goto apply;
+    }
+
+    VM_CASE(IOP_ARITH) {
+      iarith* a = c->ariths[VM_ARG];
+      int skip = VM_ARG;
+      long x;
+      /*
+      ** Run without making a number at every step, reading globals unseen, so
+      ** leaving recorded evaluations to the instructions after. The calls it
+      ** stands for use their fuel, and running out or being interrupted is
+      ** left to them too, so it fails at the same call either way.
+      */
+      if (!ivm_reads && ivm_fuel >= a->calls && !ICACHE_GET(ivm_interrupt) && iarith_run(a, e, stack + base, &x)) {
+        ivm_fuel -= a->calls;
+        stack[sp++] = ival_num(x);
+        pc += skip;
+      }
+    }
+    VM_NEXT;
+
+    VM_CASE(IOP_PAR) {
+      ipar* p = c->pars[VM_ARG];
+      int at = VM_ARG;
+      if (ipar_depth < IPAR_DEPTH && !ivm_metering && !ivm_reads && ipool_idle()) {
+        ipar_run(e, p, fn, stack + base, stack + sp);
+        sp += p->count;
+        VM_JUMP(at);
+      }
+    }
+    VM_NEXT;
+
+    VM_CASE(IOP_TEST) {
+      int otherwise = VM_ARG;
+      int end = VM_ARG;
+      ival* x = stack[sp-1];
+      if (x->type == IVAL_ERR) { VM_JUMP(end); VM_NEXT; }
+      sp--;
+      if (!ival_truthy(x)) { VM_JUMP(otherwise); }
+      ival_del(x);
+    }
+    VM_NEXT;
+
+    VM_CASE(IOP_JUMP) {
+      int at = VM_ARG;
+      VM_JUMP(at);
+    }
+    VM_NEXT;
+
+    VM_CASE(IOP_AND) {
+      int at = VM_ARG;
+      ival* x = stack[sp-1];
+      if (x->type == IVAL_ERR || !ival_truthy(x)) { VM_JUMP(at); VM_NEXT; }
+      sp--;
+      ival_del(x);
+    }
+    VM_NEXT;
+
+    VM_CASE(IOP_OR) {
+      int at = VM_ARG;
+      ival* x = stack[sp-1];
+      if (x->type == IVAL_ERR || ival_truthy(x)) { VM_JUMP(at); VM_NEXT; }
+      sp--;
+      ival_del(x);
+    }
+    VM_NEXT;
+
+    VM_CASE(IOP_BAIL) {
+      int drop = VM_ARG;
+      int at = VM_ARG;
+      ival* x = stack[sp-1];
+      if (x->type == IVAL_ERR) {
+        sp -= drop + 1;
+        for (int i = 0; i < drop; i++) { ival_del(stack[sp + i]); }
+        stack[sp++] = x;
+        VM_JUMP(at);
+      }
+    }
+    VM_NEXT;
+
+    VM_CASE(IOP_RET) {
+      /* The body of a loop goes round again with the next count and its value, unless done, stopped or failing */
+      if (loop) {
+        ival* x = stack[sp-1];
+        ival* i = stack[base];
+        if (i->num + 1 < loop && x->type != IVAL_ERR && !ival_stops(x)) {
+          VM_YIELD();
+          if ((--ivm_fuel < 0 && !ivm_slicing) || ICACHE_GET(ivm_interrupt)) {
+            ival_del(x);
+            stack[sp-1] = ICACHE_GET(ivm_interrupt) ? ival_interrupted()
+              : ival_err("Evaluation ran out of fuel after %li calls.", ival_fuel);
+          } else {
+            sp--;
+            VM_DONE();
+            ival_del(stack[base+1]);
+            stack[base+1] = x;
+            i->num++;
+            sp = base + fn->nparams + fn->ncaptured;
+            VM_ENTER(fn->chunk);
+            VM_NEXT;
+          }
+        }
+
+        /* Stopped early, the loop gives the value from before */
+        if (ival_stops(stack[sp-1])) {
+          stack[sp-1] = stack[base+1];
+          stack[base+1] = x;
+        }
+      }
+
+      ival* x = stack[--sp];
+      VM_DONE();
+      if (store) { imemo_fill(store, x); }
+
+      /* A lambda's call releases its parameters and the function below them */
+      if (call) {
+        ivm_release(stack, base, fn);
+        sp = base - 1;
+      }
+
+      /* Carry on in the caller */
+      if (nframes) {
+        nframes--;
+        c = frames[nframes].chunk;
+        pc = frames[nframes].pc;
+        base = frames[nframes].base;
+        fn = frames[nframes].fn;
+        call = frames[nframes].call;
+        loop = frames[nframes].loop;
+        store = frames[nframes].store;
+        stack[sp++] = x;
+        VM_NEXT;
+      }
+
+      if (stack != local) { free(stack); }
+      if (frames != local_frames) { free(frames); }
+      return x;
+    }
+
+  VM_END
+
+  /* Everything the run needs is moved off the C stack */
+  yield:
+  r->stack = stack == local ? ivm_grow(stack, local, sizeof(ival*), sp, cap) : stack;
+  r->frames = frames == local_frames ? ivm_grow(frames, local_frames, sizeof(iframe), nframes, capframes) : frames;
+  r->cap = cap; r->sp = sp;
+  r->nframes = nframes; r->capframes = capframes;
+  r->c = c; r->at = VM_OFFSET;
+  r->base = base; r->fn = fn; r->call = call; r->loop = loop; r->store = store;
+  return NULL;
+}
+
+/* Execute a chunk against an environment, the chunk can be run again */
+ival* ivm_run(ienv* e, ichunk* c) {
+  return ivm_exec(e, c, NULL, 0, NULL, NULL);
+}
+
+/* Evaluation */
+
+ival* ival_eval(ienv* e, ival* v) {
+  /* Only symbols and S-Expressions need any work doing */
+  if (v->type != IVAL_SYM && v->type != IVAL_SEXPR) { return v; }
+
+  /* The budget covers everything the evaluation does, evals inside it included */
+  int metered = ival_fuel > 0 && !ivm_metering;
+  if (metered) {
+    ivm_metering = 1;
+    ivm_fuel = ival_fuel;
+  }
+
+  ichunk* c = ival_compile(e, v);
+  c->once = 1;
+  ival* x = ivm_run(e, c);
+  ichunk_del(c);
+
+  if (metered) {
+    ivm_metering = 0;
+    ivm_fuel = LONG_MAX;
+  }
+  return x;
+}
+
+/* Runs */
+
+irun* irun_new(ienv* e, ival* v) {
+  irun* r = malloc(sizeof(irun));
+  r->e = e;
+  r->top = ival_compile(e, v);
+  r->top->once = 1;
+  r->abandon = 0;
+  r->stack = NULL;
+  r->frames = NULL;
+  return r;
+}
+
+/* Run with the fuel given, putting back whatever the thread was doing before */
+static ival* irun_exec(irun* r, long fuel, int slicing) {
+  long fuel_was = ivm_fuel;
+  int metered_was = ivm_metering;
+  int slicing_was = ivm_slicing;
+  ivm_fuel = fuel;
+  ivm_metering = 1;
+  ivm_slicing = slicing;
+  ival* x = ivm_exec(r->e, r->top, NULL, 0, NULL, r);
+  ivm_fuel = fuel_was;
+  ivm_metering = metered_was;
+  ivm_slicing = slicing_was;
+  return x;
+}
+
+ival* irun_resume(irun* r, long fuel) {
+  return irun_exec(r, fuel, 1);
+}
+
+void irun_del(irun* r) {
+  /* Stopped part way, so carry on with every call failing, which frees everything as it unwinds */
+  if (r->stack) {
+    r->abandon = 1;
+    ival_del(irun_exec(r, -1, 0));
+  }
+  ichunk_del(r->top);
+  free(r);
+}
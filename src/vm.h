@@ -0,0 +1,158 @@
+#ifndef IGOR_VM
+#define IGOR_VM
+
+#include "parse.h"
+
+/* Opcodes, each followed inline by its operand */
+enum {
+  IOP_CONST,   /* push a copy of constant k         */
+  IOP_GLOBAL,  /* push the value bound to symbol k   */
+  IOP_LOCAL,   /* push the value in slot k of the current lambda's frame */
+  IOP_CALL,    /* apply the top n values as a S-Expression */
+  IOP_CALLB,   /* call the builtin in slot s, symbol k, on the top n values, through the entry in constant k+2 */
+  IOP_ARITH,   /* run arithmetic tree k natively and skip the next n words, if possible */
+  IOP_PAR,     /* push the arguments of call k, evaluated at once on other threads, and go to a, if any are free */
+  IOP_TEST,    /* pop a condition and go on if true, else go to a, or leave it and go to b if an error */
+  IOP_JUMP,    /* go to a                            */
+  IOP_AND,     /* go to a if the top is false or an error, else pop it */
+  IOP_OR,      /* go to a if the top is true or an error, else pop it */
+  IOP_BAIL,    /* if the top is an error, drop the n values below it and go to a */
+  IOP_RET      /* return the top of the stack        */
+};
+
+/* Number of operands following each opcode */
+extern const int iop_operands[];
+
+/* Arguments of a call, some costly enough to be worth handing to another thread */
+typedef struct ipar {
+  int count;
+  ival** exprs;
+  int* heavy;
+
+  /* Each compiled the first time they are run, by whichever thread gets there first */
+  struct ichunk** chunks;
+} ipar;
+
+typedef struct ichunk {
+  /* Instruction stream */
+  int count;
+  int* code;
+
+  /* Constant pool, symbols for IOP_GLOBAL live here too along with where they were last found */
+  int nconsts;
+  ival** consts;
+  int* slots;
+
+  /* Deepest the value stack gets while running */
+  int depth;
+
+  /* Set when the chunk will only be run once, letting it hand out its constants */
+  int once;
+
+  /* Set when kept by a Q-Expression for eval, each frame running it then holding a reference too */
+  int shared;
+  int refs;
+
+  /* Arithmetic trees which may be compiled to native code */
+  int narith;
+  struct iarith** ariths;
+
+  /* Calls whose arguments may be evaluated in parallel */
+  int npar;
+  ipar** pars;
+
+  /* Handler addresses in place of opcodes, filled in on first run */
+  void** threaded;
+} ichunk;
+
+ichunk* ichunk_new(void);
+
+/* Let go of a chunk, freeing it once nothing else holds it */
+void ichunk_del(ichunk* c);
+
+/*
+** What eval compiled a Q-Expression to, kept on it while something besides the
+** eval holds it, as nothing then changes it. Only used again for the same
+** environment and the same names for the slots of the frame, and while no
+** global has been redefined since, as it was compiled for what they were.
+*/
+typedef struct iquote {
+  ichunk* chunk;
+  ienv* env;
+  ival* locals;
+  int redefs;
+} iquote;
+
+void iquote_del(iquote* q);
+
+/*
+** Clear to evaluate every argument of a call even after one fails, rather
+** than skipping the rest once an error is certain to be the result. The two
+** only differ where the arguments skipped would have had side effects.
+*/
+extern int ibail_enabled;
+
+/* Compile an expression for an environment, taking ownership of it */
+ichunk* ival_compile(ienv* e, ival* v);
+
+/* Compile without folding, inside a lambda whose frame slots are named by locals */
+ichunk* ival_compile_in(ienv* e, ival* locals, ival* v);
+
+/* The first error among "n" values with all the others deleted, or NULL if there is none */
+ival* ivm_first_err(ival** args, int n);
+
+/* Gather "n" values into a fresh S-Expression to hand to a builtin */
+ival* ivm_args(ival** args, int n);
+
+/* Apply "n" evaluated values the same way an S-Expression is, consuming them */
+ival* ivm_call(ienv* e, ival** args, int n);
+
+/* Execute a chunk against an environment, the chunk can be run again */
+ival* ivm_run(ienv* e, ichunk* c);
+
+/*
+** Fuel. Each call an evaluation makes uses one, and given a budget here each
+** ival_eval fails with an error once it has made that many, freeing everything
+** as it unwinds. 0 for no limit. Work is kept to the thread evaluating while
+** metered, so that all of it is counted.
+*/
+extern long ival_fuel;
+
+/*
+** Note the slot of every global this thread's evaluations read in "reads",
+** repeats and all, until given NULL. Gives what was being noted before.
+*/
+iwork* ivm_record(iwork* reads);
+
+/* Whether this thread must do all the work of its evaluation itself, being metered or having its reads noted */
+int ivm_pinned(void);
+
+/*
+** Interrupts. Once on, whatever is being evaluated fails with an error at its
+** next call, or at the next check a builtin that can run long makes, freeing
+** everything as it unwinds. Safe to turn on from a signal handler, and it
+** stays on, failing every evaluation, until turned off again.
+*/
+void ival_interrupt(int on);
+
+/* The error to fail with when interrupted, or NULL to carry on */
+ival* ival_interrupted(void);
+
+/*
+** An evaluation run a slice at a time, to interleave with other work. Each
+** resume runs until the result is ready or the fuel given, which must be more
+** than 0, runs out. It stops before the next call it makes directly, so calls
+** inside builtins, such as map's, go on to finish and may overdraw.
+*/
+typedef struct irun irun;
+
+/* Compile an expression to run, taking ownership of it */
+irun* irun_new(ienv* e, ival* v);
+
+/* Carry on for up to "fuel" calls, giving the result once finished, or NULL to be resumed again */
+ival* irun_resume(irun* r, long fuel);
+
+/* Free a run, first abandoning it if stopped part way */
+void irun_del(irun* r);
+
+#endif